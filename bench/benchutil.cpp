@@ -0,0 +1,131 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Nathan Osman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <ctime>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <QAbstractEventDispatcher>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QEventLoop>
+
+#include "benchutil.h"
+#include "rtmpserver.h"
+
+#ifdef Q_OS_LINUX
+#  include "epolltransport.h"
+#endif
+
+#ifdef HAVE_IO_URING
+#  include "iouringtransport.h"
+#endif
+
+QByteArray Bench::audioBlock()
+{
+    // One FLV audio tag header byte and 20 ms of 44.1 kHz 16-bit mono PCM
+    QByteArray block(1 + 44100 * 2 * BlockDuration / 1000, 0);
+    block[0] = 0x3e;
+    return block;
+}
+
+bool Bench::waitFor(const std::function<bool()> &condition, int timeout)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    while (!condition()) {
+        if (timer.elapsed() > timeout) {
+            return false;
+        }
+        QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents);
+    }
+
+    return true;
+}
+
+void Bench::wakeUpOnProgress(RtmpServer &server)
+{
+    // The server runs on another thread, so without this the event loop
+    // would sleep through progress that is only visible on the server
+    QAbstractEventDispatcher *dispatcher = QAbstractEventDispatcher::instance();
+    server.setProgressCallback([dispatcher]() {
+        dispatcher->wakeUp();
+    });
+}
+
+qint64 Bench::threadCpuTime()
+{
+    timespec time;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+    return time.tv_sec * 1000000000ll + time.tv_nsec;
+}
+
+bool Bench::hasSyscallCount(Transport::Backend backend)
+{
+    return backend != Transport::Backend::Qt;
+}
+
+quint64 Bench::syscallCount(Transport::Backend backend)
+{
+    switch (backend) {
+#ifdef Q_OS_LINUX
+    case Transport::Backend::Epoll:
+        return EpollLoop::instance()->syscallCount();
+#endif
+#ifdef HAVE_IO_URING
+    case Transport::Backend::IoUring:
+        return IoUringLoop::instance()->syscallCount();
+#endif
+    default:
+        return 0;
+    }
+}
+
+bool Bench::hasKernelTls()
+{
+    // The ULP can only be attached to a connected socket, which also loads
+    // the tls module on demand
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof (address);
+
+    const int listenFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    const int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    const bool available =
+            bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof (address)) == 0 &&
+            listen(listenFd, 1) == 0 &&
+            getsockname(listenFd, reinterpret_cast<sockaddr*>(&address), &length) == 0 &&
+            connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof (address)) == 0 &&
+            setsockopt(fd, IPPROTO_TCP, TCP_ULP, "tls", sizeof ("tls")) == 0;
+
+    ::close(fd);
+    ::close(listenFd);
+    return available;
+}
@@ -0,0 +1,61 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Nathan Osman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef BENCHUTIL_H
+#define BENCHUTIL_H
+
+#include <functional>
+
+#include <QByteArray>
+
+#include "transport.h"
+
+class RtmpServer;
+
+/**
+ * @brief Helpers shared by the benchmarks
+ */
+namespace Bench
+{
+
+/**
+ * @brief Duration of each audio block in milliseconds
+ */
+const int BlockDuration = 20;
+const int BlocksPerSecond = 1000 / BlockDuration;
+
+QByteArray audioBlock();
+
+bool waitFor(const std::function<bool()> &condition, int timeout = 30000);
+void wakeUpOnProgress(RtmpServer &server);
+
+qint64 threadCpuTime();
+bool hasSyscallCount(Transport::Backend backend);
+quint64 syscallCount(Transport::Backend backend);
+
+bool hasKernelTls();
+
+}
+
+#endif // BENCHUTIL_H
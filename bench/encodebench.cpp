@@ -0,0 +1,129 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Nathan Osman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QThread>
+#include <QWaitCondition>
+
+#include "encodepool.h"
+
+// Samples in a 20 ms frame at 44.1 kHz
+const int SamplesPerFrame = 882;
+
+static QByteArray frame()
+{
+    // A tone rather than silence, so that ADPCM adapts its step size
+    QByteArray data(SamplesPerFrame * 2, 0);
+    qint16 *samples = reinterpret_cast<qint16*>(data.data());
+    for (int i = 0; i < SamplesPerFrame; ++i) {
+        samples[i] = static_cast<qint16>((i % 100) * 300 - 15000);
+    }
+    return data;
+}
+
+// Submits one frame on every stream per iteration, the way a round of
+// capture callbacks would, and waits until all of them have been encoded.
+// Latency runs from each submit() to the encoded signal for that frame.
+static void BM_Encode(benchmark::State &state)
+{
+    const EncodePool::Codec codec = static_cast<EncodePool::Codec>(state.range(0));
+    const int streamCount = static_cast<int>(state.range(1));
+
+    EncodePool pool;
+
+    QHash<int, int> streamIndexes;
+    QList<int> streamIds;
+    for (int i = 0; i < streamCount; ++i) {
+        const int streamId = pool.addStream(codec);
+        streamIndexes.insert(streamId, i);
+        streamIds.append(streamId);
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    // Each stream has one frame in flight at a time, so its slots are only
+    // written by one thread between waits
+    std::vector<qint64> submitted(streamCount);
+    std::vector<qint64> latencies(streamCount);
+    std::atomic<int> encodedCount(0);
+
+    QMutex mutex;
+    QWaitCondition allEncoded;
+
+    QObject::connect(&pool, &EncodePool::encoded, [&](int streamId, const QByteArray &, quint32, quint64) {
+        const int index = streamIndexes.value(streamId);
+        latencies[index] = timer.nsecsElapsed() - submitted[index];
+        if (++encodedCount == streamCount) {
+            QMutexLocker locker(&mutex);
+            allEncoded.wakeOne();
+        }
+    });
+
+    const QByteArray data = frame();
+    std::vector<qint64> samples;
+
+    for (auto _ : state) {
+        encodedCount = 0;
+        for (int i = 0; i < streamCount; ++i) {
+            submitted[i] = timer.nsecsElapsed();
+            pool.submit(streamIds.at(i), data);
+        }
+
+        QMutexLocker locker(&mutex);
+        while (encodedCount < streamCount) {
+            allEncoded.wait(&mutex);
+        }
+        samples.insert(samples.end(), latencies.begin(), latencies.end());
+    }
+
+    std::sort(samples.begin(), samples.end());
+    if (!samples.empty()) {
+        state.counters["p50_us"] = samples.at(samples.size() / 2) / 1e3;
+        state.counters["p99_us"] = samples.at(samples.size() * 99 / 100) / 1e3;
+    }
+    state.counters["streams/core"] = static_cast<double>(streamCount) / QThread::idealThreadCount();
+    state.SetItemsProcessed(state.iterations() * streamCount);
+}
+
+BENCHMARK(BM_Encode)
+    ->ArgNames({"codec", "streams"})
+    ->ArgsProduct({
+        {
+            static_cast<int>(EncodePool::Codec::Pcm),
+            static_cast<int>(EncodePool::Codec::Adpcm)
+        },
+        {1, 4, 16, 64, 256, 1024}
+    })
+    ->Unit(benchmark::kMicrosecond)
+    ->UseRealTime();
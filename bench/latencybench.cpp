@@ -0,0 +1,141 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Nathan Osman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <algorithm>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include <QElapsedTimer>
+
+#include "benchutil.h"
+#include "client.h"
+#include "rtmpserver.h"
+
+enum class Load {
+    Idle,
+    Saturated
+};
+
+// Slower than the audio, so a saturated uplink only ever falls further behind
+const qint64 UplinkRate = 64 * 1024;
+const int PingInterval = 100;
+
+static double percentile(std::vector<qint64> &times, double fraction)
+{
+    std::sort(times.begin(), times.end());
+    const size_t index = static_cast<size_t>(fraction * (times.size() - 1) + 0.5);
+    return times.at(index) / 1e6;
+}
+
+// Publishes one stream in real time to a server that reads slower than the
+// audio arrives and times its pings. Each iteration waits for one response,
+// so the ping responses compete with a growing backlog of audio.
+static void BM_PingUnderLoad(benchmark::State &state)
+{
+    const Transport::Backend backend = static_cast<Transport::Backend>(state.range(0));
+    const Load load = static_cast<Load>(state.range(1));
+
+    if (!Transport::isAvailable(backend)) {
+        state.SkipWithError("backend is not available");
+        return;
+    }
+
+    RtmpServer server;
+    server.setReadRate(UplinkRate);
+    server.setPingInterval(PingInterval);
+    if (!server.listen()) {
+        state.SkipWithError("unable to listen");
+        return;
+    }
+    Bench::wakeUpOnProgress(server);
+    server.start();
+
+    Client client(backend);
+    client.start(server.url("stream"));
+
+    if (!Bench::waitFor([&]() { return client.isPublishing(); })) {
+        state.SkipWithError("stream did not start publishing");
+        return;
+    }
+
+    // Pings answered before publishing started are not under load
+    server.takePingTimes();
+
+    const QByteArray block = Bench::audioBlock();
+    QElapsedTimer timer;
+    timer.start();
+    quint32 timestamp = 0;
+
+    auto sendDueBlocks = [&]() {
+        if (load == Load::Saturated) {
+            while (timestamp <= timer.elapsed()) {
+                client.sendAudio(block, timestamp);
+                timestamp += Bench::BlockDuration;
+            }
+        }
+    };
+
+    std::vector<qint64> times;
+    size_t expected = 0;
+    for (auto _ : state) {
+        ++expected;
+        const bool answered = Bench::waitFor([&]() {
+            sendDueBlocks();
+            for (qint64 time : server.takePingTimes()) {
+                times.push_back(time);
+            }
+            return times.size() >= expected;
+        });
+
+        if (!answered) {
+            state.SkipWithError("ping was not answered");
+            break;
+        }
+    }
+
+    if (!times.empty()) {
+        state.counters["p50_ms"] = percentile(times, 0.5);
+        state.counters["p99_ms"] = percentile(times, 0.99);
+        state.counters["max_ms"] = times.back() / 1e6;
+    }
+    state.counters["received_KiB/s"] = server.audioByteCount() / 1024.0 / (timer.elapsed() / 1000.0);
+}
+
+BENCHMARK(BM_PingUnderLoad)
+    ->ArgNames({"backend", "load"})
+    ->ArgsProduct({
+        {
+            static_cast<int>(Transport::Backend::Qt),
+            static_cast<int>(Transport::Backend::Epoll),
+            static_cast<int>(Transport::Backend::IoUring)
+        },
+        {
+            static_cast<int>(Load::Idle),
+            static_cast<int>(Load::Saturated)
+        }
+    })
+    ->Iterations(50)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
@@ -0,0 +1,720 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Nathan Osman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <cerrno>
+#include <ctime>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <openssl/evp.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+
+#include <QMutexLocker>
+#include <QVariantMap>
+#include <QtEndian>
+
+#include "amf.h"
+#include "rtmpserver.h"
+
+const int HandshakeSize = 1536;
+
+const quint32 ExtendedTimestamp = 0xffffff;
+const int DefaultChunkSize = 128;
+
+const quint8 MessageSetChunkSize = 1;
+const quint8 MessageUserControl = 4;
+const quint8 MessageAudio = 8;
+const quint8 MessageCommand = 20;
+
+const quint16 EventPingRequest = 6;
+const quint16 EventPingResponse = 7;
+
+const quint32 ControlChunkStreamId = 2;
+const quint32 CommandChunkStreamId = 3;
+const quint32 StatusChunkStreamId = 5;
+const quint32 PublishStreamId = 1;
+
+// Period of the timer that refills read budgets and sends pings
+const int TickInterval = 10;
+
+// Small enough that a throttled connection backs up on the client
+const int ThrottledReceiveBuffer = 16384;
+
+struct RtmpServer::Connection
+{
+    struct ChunkStream
+    {
+        quint32 length = 0;
+        quint8 typeId = 0;
+        bool extended = false;
+        QByteArray payload;
+    };
+
+    int fd;
+    SSL *ssl;
+
+    enum {
+        StateVersion = 0,
+        StateAck,
+        StateConnected
+    } state;
+
+    QByteArray readBuffer;
+    QByteArray writeBuffer;
+
+    QHash<quint32, ChunkStream> chunkStreams;
+    int chunkSize;
+
+    // Bytes that may still be read before the next tick, or -1 if unlimited
+    qint64 readBudget;
+    bool paused;
+
+    // Time the outstanding ping was sent, or 0 if there is none
+    qint64 pingSent;
+};
+
+inline quint32 readUInt24(const uchar *data)
+{
+    return (data[0] << 16) | (data[1] << 8) | data[2];
+}
+
+inline void appendUInt24(QByteArray &data, quint32 value)
+{
+    data.append(static_cast<char>(value >> 16));
+    data.append(static_cast<char>(value >> 8));
+    data.append(static_cast<char>(value));
+}
+
+static qint64 monotonicTime()
+{
+    timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1000000000ll + time.tv_nsec;
+}
+
+RtmpServer::RtmpServer()
+    : mListenFd(-1)
+    , mEpollFd(epoll_create1(EPOLL_CLOEXEC))
+    , mWakeFd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK))
+    , mTimerFd(-1)
+    , mPort(0)
+    , mSslContext(nullptr)
+    , mPublishedCount(0)
+    , mAudioMessageCount(0)
+    , mAudioByteCount(0)
+    , mReadRate(0)
+    , mPingInterval(0)
+    , mPingElapsed(0)
+{
+}
+
+RtmpServer::~RtmpServer()
+{
+    stop();
+
+    for (Connection *connection : mConnections.values()) {
+        SSL_free(connection->ssl);
+        ::close(connection->fd);
+        delete connection;
+    }
+    qDeleteAll(mClosedConnections);
+
+    if (mListenFd != -1) {
+        ::close(mListenFd);
+    }
+    if (mTimerFd != -1) {
+        ::close(mTimerFd);
+    }
+    ::close(mWakeFd);
+    ::close(mEpollFd);
+
+    SSL_CTX_free(mSslContext);
+}
+
+// Self-signed certificate for 127.0.0.1, which is all the clients see
+static SSL_CTX *createSslContext()
+{
+    EVP_PKEY *key = EVP_EC_gen("P-256");
+    X509 *certificate = X509_new();
+    SSL_CTX *context = SSL_CTX_new(TLS_server_method());
+
+    bool ok = key && certificate && context;
+    if (ok) {
+        ASN1_INTEGER_set(X509_get_serialNumber(certificate), 1);
+        X509_gmtime_adj(X509_getm_notBefore(certificate), 0);
+        X509_gmtime_adj(X509_getm_notAfter(certificate), 24 * 60 * 60);
+        X509_set_pubkey(certificate, key);
+
+        X509_NAME *name = X509_get_subject_name(certificate);
+        X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+                                   reinterpret_cast<const uchar*>("127.0.0.1"), -1, -1, 0);
+        X509_set_issuer_name(certificate, name);
+
+        ok = X509_sign(certificate, key, EVP_sha256()) &&
+                SSL_CTX_use_certificate(context, certificate) == 1 &&
+                SSL_CTX_use_PrivateKey(context, key) == 1;
+    }
+
+    // Buffered records may be retried from a write buffer that has moved
+    if (ok) {
+        SSL_CTX_set_mode(context, SSL_MODE_ENABLE_PARTIAL_WRITE |
+                                  SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    } else {
+        SSL_CTX_free(context);
+        context = nullptr;
+    }
+
+    X509_free(certificate);
+    EVP_PKEY_free(key);
+    return context;
+}
+
+bool RtmpServer::listen(bool secure)
+{
+    if (secure) {
+        mSslContext = createSslContext();
+        if (!mSslContext) {
+            return false;
+        }
+    }
+
+    mListenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (mListenFd == -1) {
+        return false;
+    }
+
+    // Accepted sockets inherit the buffer size, which must be set before
+    // the window scale is negotiated
+    if (mReadRate) {
+        const int size = ThrottledReceiveBuffer;
+        setsockopt(mListenFd, SOL_SOCKET, SO_RCVBUF, &size, sizeof (size));
+    }
+
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    socklen_t length = sizeof (address);
+    if (bind(mListenFd, reinterpret_cast<sockaddr*>(&address), sizeof (address)) == -1 ||
+            ::listen(mListenFd, 4096) == -1 ||
+            getsockname(mListenFd, reinterpret_cast<sockaddr*>(&address), &length) == -1) {
+        return false;
+    }
+    mPort = ntohs(address.sin_port);
+
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.ptr = nullptr;
+    if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mListenFd, &event) == -1) {
+        return false;
+    }
+
+    event.data.ptr = &mWakeFd;
+    if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mWakeFd, &event) == -1) {
+        return false;
+    }
+
+    if (!mReadRate && !mPingInterval) {
+        return true;
+    }
+
+    mTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    const itimerspec interval{
+        {0, TickInterval * 1000000},
+        {0, TickInterval * 1000000}
+    };
+    event.data.ptr = &mTimerFd;
+    return mTimerFd != -1 &&
+            timerfd_settime(mTimerFd, 0, &interval, nullptr) == 0 &&
+            epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mTimerFd, &event) == 0;
+}
+
+void RtmpServer::stop()
+{
+    const quint64 value = 1;
+    if (::write(mWakeFd, &value, sizeof (value)) != sizeof (value)) {
+        // The counter can only overflow after 2^64 - 1 writes
+    }
+    wait();
+}
+
+QUrl RtmpServer::url(const QString &streamKey) const
+{
+    return QUrl(QString("%1://127.0.0.1:%2/live/%3")
+                .arg(mSslContext ? "rtmps" : "rtmp")
+                .arg(mPort)
+                .arg(streamKey));
+}
+
+void RtmpServer::setProgressCallback(const std::function<void()> &callback)
+{
+    mProgressCallback = callback;
+}
+
+void RtmpServer::setReadRate(qint64 bytesPerSecond)
+{
+    mReadRate = bytesPerSecond;
+}
+
+void RtmpServer::setPingInterval(int msec)
+{
+    mPingInterval = msec;
+}
+
+QList<qint64> RtmpServer::takePingTimes()
+{
+    QMutexLocker locker(&mPingMutex);
+    QList<qint64> pingTimes;
+    pingTimes.swap(mPingTimes);
+    return pingTimes;
+}
+
+void RtmpServer::run()
+{
+    const int MaxEvents = 256;
+    epoll_event events[MaxEvents];
+
+    forever {
+        const int count = epoll_wait(mEpollFd, events, MaxEvents, -1);
+        if (count == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+
+        for (int i = 0; i < count; ++i) {
+            void *ptr = events[i].data.ptr;
+            if (ptr == &mWakeFd) {
+                return;
+            } else if (ptr == &mTimerFd) {
+                tick();
+            } else if (!ptr) {
+                accept();
+            } else {
+                Connection *connection = static_cast<Connection*>(ptr);
+                if (connection->fd == -1) {
+                    continue;
+                }
+                if (events[i].events & EPOLLOUT) {
+                    flush(connection);
+                }
+                if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+                    read(connection);
+                }
+            }
+        }
+
+        qDeleteAll(mClosedConnections);
+        mClosedConnections.clear();
+
+        if (mProgressCallback) {
+            mProgressCallback();
+        }
+    }
+}
+
+void RtmpServer::accept()
+{
+    forever {
+        const int fd = accept4(mListenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1) {
+            return;
+        }
+
+        int enabled = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enabled, sizeof (enabled));
+
+        Connection *connection = new Connection;
+        connection->fd = fd;
+        connection->ssl = nullptr;
+        connection->state = Connection::StateVersion;
+        connection->chunkSize = DefaultChunkSize;
+        connection->readBudget = mReadRate ? mReadRate * TickInterval / 1000 : -1;
+        connection->paused = false;
+        connection->pingSent = 0;
+
+        // The TLS handshake happens implicitly in the first read
+        if (mSslContext) {
+            connection->ssl = SSL_new(mSslContext);
+            SSL_set_fd(connection->ssl, fd);
+            SSL_set_accept_state(connection->ssl);
+        }
+
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.ptr = connection;
+        epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, &event);
+
+        mConnections.insert(fd, connection);
+    }
+}
+
+void RtmpServer::tick()
+{
+    quint64 expirations;
+    if (::read(mTimerFd, &expirations, sizeof (expirations)) != sizeof (expirations)) {
+        return;
+    }
+
+    mPingElapsed += static_cast<int>(expirations) * TickInterval;
+    const bool ping = mPingInterval && mPingElapsed >= mPingInterval;
+    if (ping) {
+        mPingElapsed = 0;
+    }
+
+    for (Connection *connection : mConnections.values()) {
+        if (connection->fd == -1) {
+            continue;
+        }
+
+        // Only one ping is outstanding at a time, so a slow response is
+        // measured rather than queued behind
+        if (ping && connection->state == Connection::StateConnected && !connection->pingSent) {
+            QByteArray payload;
+            const quint16 eventType = qToBigEndian<quint16>(EventPingRequest);
+            const quint32 timestamp = qToBigEndian<quint32>(
+                        static_cast<quint32>(monotonicTime() / 1000000));
+            payload.append(reinterpret_cast<const char*>(&eventType), sizeof (eventType));
+            payload.append(reinterpret_cast<const char*>(&timestamp), sizeof (timestamp));
+            connection->pingSent = monotonicTime();
+            sendMessage(connection, ControlChunkStreamId, MessageUserControl, 0, payload);
+        }
+
+        // Data left in the TLS session is read without waiting for the socket
+        if (mReadRate) {
+            connection->readBudget = mReadRate * TickInterval / 1000;
+            if (connection->paused) {
+                connection->paused = false;
+                watch(connection);
+                read(connection);
+            }
+        }
+    }
+}
+
+void RtmpServer::read(Connection *connection)
+{
+    char buffer[65536];
+
+    forever {
+
+        // A throttled connection is not watched for input until the next tick
+        if (connection->readBudget == 0) {
+            connection->paused = true;
+            watch(connection);
+            break;
+        }
+
+        const size_t limit = connection->readBudget == -1 ?
+                    sizeof (buffer) : qMin<size_t>(sizeof (buffer), connection->readBudget);
+        const ssize_t size = receive(connection, buffer, limit);
+        if (size == 0 || (size == -1 && errno != EAGAIN && errno != EINTR)) {
+            close(connection);
+            return;
+        }
+        if (size == -1) {
+            break;
+        }
+        connection->readBuffer.append(buffer, static_cast<int>(size));
+        if (connection->readBudget != -1) {
+            connection->readBudget -= size;
+        }
+    }
+
+    forever {
+        switch (connection->state) {
+        case Connection::StateVersion:
+            if (connection->readBuffer.size() < 1 + HandshakeSize) {
+                return;
+            }
+
+            // S0 and S1, followed by S2 which echoes C1
+            {
+                QByteArray response(1 + HandshakeSize, 0);
+                response[0] = 0x03;
+                response.append(connection->readBuffer.mid(1, HandshakeSize));
+                connection->writeBuffer.append(response);
+                connection->readBuffer.remove(0, 1 + HandshakeSize);
+                connection->state = Connection::StateAck;
+                flush(connection);
+            }
+            break;
+        case Connection::StateAck:
+            if (connection->readBuffer.size() < HandshakeSize) {
+                return;
+            }
+            connection->readBuffer.remove(0, HandshakeSize);
+            connection->state = Connection::StateConnected;
+            break;
+        case Connection::StateConnected:
+            if (!processChunk(connection)) {
+                return;
+            }
+            break;
+        }
+    }
+}
+
+void RtmpServer::flush(Connection *connection)
+{
+    while (!connection->writeBuffer.isEmpty()) {
+        const ssize_t size = send(connection, connection->writeBuffer.constData(),
+                                  connection->writeBuffer.size());
+        if (size == -1) {
+            break;
+        }
+        connection->writeBuffer.remove(0, static_cast<int>(size));
+    }
+
+    watch(connection);
+}
+
+void RtmpServer::watch(Connection *connection)
+{
+    epoll_event event{};
+    event.events = (connection->paused ? 0 : static_cast<quint32>(EPOLLIN)) |
+            (connection->writeBuffer.isEmpty() ? 0 : static_cast<quint32>(EPOLLOUT));
+    event.data.ptr = connection;
+    epoll_ctl(mEpollFd, EPOLL_CTL_MOD, connection->fd, &event);
+}
+
+void RtmpServer::close(Connection *connection)
+{
+    mConnections.remove(connection->fd);
+    SSL_free(connection->ssl);
+    connection->ssl = nullptr;
+    ::close(connection->fd);
+
+    // Later events in the same batch may still refer to the connection
+    connection->fd = -1;
+    mClosedConnections.append(connection);
+}
+
+// For TLS, both wants are reported as EAGAIN, since the handshake is small
+// enough to fit in the socket buffer and read() is retried on every event
+static ssize_t sslResult(SSL *ssl, int ret)
+{
+    if (ret > 0) {
+        return ret;
+    }
+
+    switch (SSL_get_error(ssl, ret)) {
+    case SSL_ERROR_WANT_READ:
+    case SSL_ERROR_WANT_WRITE:
+        errno = EAGAIN;
+        return -1;
+    case SSL_ERROR_ZERO_RETURN:
+        return 0;
+    default:
+        errno = EIO;
+        return -1;
+    }
+}
+
+ssize_t RtmpServer::receive(Connection *connection, char *data, size_t size)
+{
+    if (connection->ssl) {
+        return sslResult(connection->ssl, SSL_read(connection->ssl, data, static_cast<int>(size)));
+    }
+    return recv(connection->fd, data, size, 0);
+}
+
+ssize_t RtmpServer::send(Connection *connection, const char *data, size_t size)
+{
+    if (connection->ssl) {
+        return sslResult(connection->ssl, SSL_write(connection->ssl, data, static_cast<int>(size)));
+    }
+    return ::send(connection->fd, data, size, MSG_NOSIGNAL);
+}
+
+bool RtmpServer::processChunk(Connection *connection)
+{
+    const uchar *data = reinterpret_cast<const uchar*>(connection->readBuffer.constData());
+    const int size = connection->readBuffer.size();
+    if (size < 1) {
+        return false;
+    }
+
+    const quint8 format = data[0] >> 6;
+    quint32 chunkStreamId = data[0] & 0x3f;
+    int offset = 1;
+    if (chunkStreamId == 0) {
+        if (size < 2) {
+            return false;
+        }
+        chunkStreamId = 64 + data[1];
+        offset = 2;
+    } else if (chunkStreamId == 1) {
+        if (size < 3) {
+            return false;
+        }
+        chunkStreamId = 64 + data[1] + (data[2] << 8);
+        offset = 3;
+    }
+
+    static const int headerSizes[] = {11, 7, 3, 0};
+    if (size < offset + headerSizes[format]) {
+        return false;
+    }
+
+    Connection::ChunkStream &chunkStream = connection->chunkStreams[chunkStreamId];
+    if (format <= 2) {
+        chunkStream.extended = readUInt24(data + offset) == ExtendedTimestamp;
+    }
+    if (format <= 1) {
+        chunkStream.length = readUInt24(data + offset + 3);
+        chunkStream.typeId = data[offset + 6];
+    }
+    offset += headerSizes[format];
+    if (chunkStream.extended) {
+        offset += 4;
+    }
+
+    const int payloadSize = qMin<qint64>(connection->chunkSize,
+                                         chunkStream.length - chunkStream.payload.size());
+    if (size < offset + payloadSize) {
+        return false;
+    }
+
+    chunkStream.payload.append(connection->readBuffer.constData() + offset, payloadSize);
+    connection->readBuffer.remove(0, offset + payloadSize);
+
+    if (static_cast<quint32>(chunkStream.payload.size()) >= chunkStream.length) {
+        QByteArray payload;
+        payload.swap(chunkStream.payload);
+        processMessage(connection, chunkStream.typeId, payload);
+    }
+
+    return connection->fd != -1;
+}
+
+void RtmpServer::processMessage(Connection *connection, quint8 typeId, const QByteArray &payload)
+{
+    switch (typeId) {
+    case MessageSetChunkSize:
+        if (payload.size() >= 4) {
+            connection->chunkSize = static_cast<int>(
+                qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(payload.constData())) & 0x7fffffff);
+        }
+        break;
+    case MessageUserControl:
+        processUserControl(connection, payload);
+        break;
+    case MessageAudio:
+        ++mAudioMessageCount;
+        mAudioByteCount += payload.size();
+        break;
+    case MessageCommand:
+        processCommand(connection, payload);
+        break;
+    }
+}
+
+void RtmpServer::processUserControl(Connection *connection, const QByteArray &payload)
+{
+    if (payload.size() < 6 || !connection->pingSent) {
+        return;
+    }
+
+    const quint16 eventType = qFromBigEndian<quint16>(reinterpret_cast<const uchar*>(payload.constData()));
+    if (eventType == EventPingResponse) {
+        const qint64 pingTime = monotonicTime() - connection->pingSent;
+        connection->pingSent = 0;
+
+        QMutexLocker locker(&mPingMutex);
+        mPingTimes.append(pingTime);
+    }
+}
+
+void RtmpServer::processCommand(Connection *connection, const QByteArray &payload)
+{
+    QVariantList values;
+    if (!Amf::decode(payload, values) || values.size() < 2) {
+        return;
+    }
+
+    const QString name = values.at(0).toString();
+    const QVariant transactionId = values.at(1);
+
+    if (name == "connect") {
+        sendMessage(connection, CommandChunkStreamId, MessageCommand, 0, Amf::encode({
+            "_result",
+            transactionId,
+            QVariantMap{{"fmsVer", "FMS/3,0,1,123"}},
+            QVariantMap{
+                {"level", "status"},
+                {"code", "NetConnection.Connect.Success"}
+            }
+        }));
+    } else if (name == "createStream") {
+        sendMessage(connection, CommandChunkStreamId, MessageCommand, 0, Amf::encode({
+            "_result",
+            transactionId,
+            QVariant(),
+            PublishStreamId
+        }));
+    } else if (name == "publish") {
+        sendMessage(connection, StatusChunkStreamId, MessageCommand, PublishStreamId, Amf::encode({
+            "onStatus",
+            0,
+            QVariant(),
+            QVariantMap{
+                {"level", "status"},
+                {"code", "NetStream.Publish.Start"}
+            }
+        }));
+        ++mPublishedCount;
+    }
+}
+
+void RtmpServer::sendMessage(Connection *connection, quint32 chunkStreamId, quint8 typeId,
+                             quint32 streamId, const QByteArray &payload)
+{
+    // The server never changes its chunk size
+    QByteArray message;
+    for (int offset = 0; offset == 0 || offset < payload.size(); offset += DefaultChunkSize) {
+        if (offset == 0) {
+            message.append(static_cast<char>(chunkStreamId));
+            appendUInt24(message, 0);
+            appendUInt24(message, static_cast<quint32>(payload.size()));
+            message.append(static_cast<char>(typeId));
+            const quint32 littleEndianStreamId = qToLittleEndian<quint32>(streamId);
+            message.append(reinterpret_cast<const char*>(&littleEndianStreamId), sizeof (quint32));
+        } else {
+            message.append(static_cast<char>(0xc0 | chunkStreamId));
+        }
+        message.append(payload.mid(offset, DefaultChunkSize));
+    }
+
+    connection->writeBuffer.append(message);
+    flush(connection);
+}
@@ -0,0 +1,145 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Nathan Osman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef RTMPSERVER_H
+#define RTMPSERVER_H
+
+#include <atomic>
+#include <functional>
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QThread>
+#include <QUrl>
+
+typedef struct ssl_ctx_st SSL_CTX;
+
+/**
+ * @brief Minimal RTMP server that accepts publishers for benchmarking
+ *
+ * The server runs on its own thread with a plain epoll loop, so that it does
+ * not compete with the event loop of the thread being measured. It completes
+ * the handshake, answers connect, createStream and publish, and counts the
+ * audio messages it receives.
+ *
+ * A secure server accepts RTMPS with a self-signed certificate generated
+ * when it starts listening, so clients must not verify the peer.
+ *
+ * For latency measurements the server can stand in for a slow uplink by
+ * limiting how fast it reads, and can ping its publishers periodically.
+ * Both must be configured before listen() is called.
+ */
+class RtmpServer : public QThread
+{
+public:
+
+    RtmpServer();
+    virtual ~RtmpServer();
+
+    bool listen(bool secure = false);
+    void stop();
+
+    QUrl url(const QString &streamKey) const;
+
+    inline int publishedCount() const { return mPublishedCount; }
+    inline qint64 audioMessageCount() const { return mAudioMessageCount; }
+    inline qint64 audioByteCount() const { return mAudioByteCount; }
+
+    /**
+     * @brief Set a function invoked on the server thread after each batch
+     */
+    void setProgressCallback(const std::function<void()> &callback);
+
+    /**
+     * @brief Limit how fast each connection is read
+     *
+     * The receive buffer is shrunk as well, so that data the server has not
+     * read yet backs up on the client rather than in the server's kernel.
+     */
+    void setReadRate(qint64 bytesPerSecond);
+
+    /**
+     * @brief Send a ping request to each connection at the given interval
+     */
+    void setPingInterval(int msec);
+
+    /**
+     * @brief Retrieve the round trips of the pings answered so far, in nanoseconds
+     */
+    QList<qint64> takePingTimes();
+
+protected:
+
+    virtual void run();
+
+private:
+
+    struct Connection;
+
+    void accept();
+    void tick();
+    void read(Connection *connection);
+    void flush(Connection *connection);
+    void watch(Connection *connection);
+    void close(Connection *connection);
+
+    ssize_t receive(Connection *connection, char *data, size_t size);
+    ssize_t send(Connection *connection, const char *data, size_t size);
+
+    bool processChunk(Connection *connection);
+    void processMessage(Connection *connection, quint8 typeId, const QByteArray &payload);
+    void processUserControl(Connection *connection, const QByteArray &payload);
+    void processCommand(Connection *connection, const QByteArray &payload);
+
+    void sendMessage(Connection *connection, quint32 chunkStreamId, quint8 typeId,
+                     quint32 streamId, const QByteArray &payload);
+
+    int mListenFd;
+    int mEpollFd;
+    int mWakeFd;
+    int mTimerFd;
+    quint16 mPort;
+
+    SSL_CTX *mSslContext;
+
+    QHash<int, Connection*> mConnections;
+    QList<Connection*> mClosedConnections;
+
+    std::atomic<int> mPublishedCount;
+    std::atomic<qint64> mAudioMessageCount;
+    std::atomic<qint64> mAudioByteCount;
+
+    std::function<void()> mProgressCallback;
+
+    qint64 mReadRate;
+    int mPingInterval;
+    int mPingElapsed;
+
+    QMutex mPingMutex;
+    QList<qint64> mPingTimes;
+};
+
+#endif // RTMPSERVER_H
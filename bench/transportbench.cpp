@@ -0,0 +1,164 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Nathan Osman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <QList>
+
+#include "benchutil.h"
+#include "client.h"
+#include "rtmpserver.h"
+
+enum class Security {
+    Plain,
+    Userspace,
+    Kernel
+};
+
+// Publishes one block per iteration on every stream and waits for the
+// server to receive all of them. CPU time is that of the publishing thread
+// alone, since the server runs on a thread of its own.
+static void publish(benchmark::State &state, Transport::Backend backend,
+                    int streamCount, Security security)
+{
+    if (!Transport::isAvailable(backend)) {
+        state.SkipWithError("backend is not available");
+        return;
+    }
+
+    if (security == Security::Kernel && !Bench::hasKernelTls()) {
+        state.SkipWithError("kTLS is not available");
+        return;
+    }
+
+    RtmpServer server;
+    if (!server.listen(security != Security::Plain)) {
+        state.SkipWithError("unable to listen");
+        return;
+    }
+    Bench::wakeUpOnProgress(server);
+    server.start();
+
+    QList<Client*> clients;
+    for (int i = 0; i < streamCount; ++i) {
+        Client *client = new Client(backend);
+        client->setVerifyPeer(false);
+        client->setTlsOffload(security == Security::Kernel);
+        client->start(server.url(QString("stream%1").arg(i)));
+        clients.append(client);
+    }
+
+    const bool published = Bench::waitFor([&]() {
+        for (Client *client : clients) {
+            if (!client->isPublishing()) {
+                return false;
+            }
+        }
+        return true;
+    });
+
+    if (!published) {
+        state.SkipWithError("streams did not start publishing");
+        qDeleteAll(clients);
+        return;
+    }
+
+    const QByteArray block = Bench::audioBlock();
+    quint32 timestamp = 0;
+    qint64 expected = server.audioMessageCount();
+
+    const quint64 syscallsBefore = Bench::syscallCount(backend);
+    const qint64 cpuTimeBefore = Bench::threadCpuTime();
+
+    for (auto _ : state) {
+        for (Client *client : clients) {
+            client->sendAudio(block, timestamp);
+        }
+        timestamp += Bench::BlockDuration;
+        expected += streamCount;
+
+        if (!Bench::waitFor([&]() { return server.audioMessageCount() >= expected; })) {
+            state.SkipWithError("server did not receive every block");
+            break;
+        }
+    }
+
+    // Scale to one stream and one second of audio
+    const double seconds = static_cast<double>(state.iterations()) / Bench::BlocksPerSecond;
+    const double streamSeconds = seconds * streamCount;
+
+    state.counters["cpu%/stream"] =
+            (Bench::threadCpuTime() - cpuTimeBefore) / 1e7 / streamSeconds;
+    if (Bench::hasSyscallCount(backend)) {
+        state.counters["syscalls/stream/s"] =
+                (Bench::syscallCount(backend) - syscallsBefore) / streamSeconds;
+    }
+
+    qDeleteAll(clients);
+}
+
+static void BM_Publish(benchmark::State &state)
+{
+    publish(state,
+            static_cast<Transport::Backend>(state.range(0)),
+            static_cast<int>(state.range(1)),
+            Security::Plain);
+}
+
+// The socket backends only, since QSslSocket cannot use kTLS
+static void BM_PublishSecure(benchmark::State &state)
+{
+    publish(state,
+            static_cast<Transport::Backend>(state.range(0)),
+            static_cast<int>(state.range(2)),
+            static_cast<Security>(state.range(1)));
+}
+
+BENCHMARK(BM_Publish)
+    ->ArgNames({"backend", "streams"})
+    ->ArgsProduct({
+        {
+            static_cast<int>(Transport::Backend::Qt),
+            static_cast<int>(Transport::Backend::Epoll),
+            static_cast<int>(Transport::Backend::IoUring)
+        },
+        {1000}
+    })
+    ->Unit(benchmark::kMillisecond);
+
+BENCHMARK(BM_PublishSecure)
+    ->ArgNames({"backend", "security", "streams"})
+    ->ArgsProduct({
+        {
+            static_cast<int>(Transport::Backend::Epoll),
+            static_cast<int>(Transport::Backend::IoUring)
+        },
+        {
+            static_cast<int>(Security::Plain),
+            static_cast<int>(Security::Userspace),
+            static_cast<int>(Security::Kernel)
+        },
+        {1000}
+    })
+    ->Unit(benchmark::kMillisecond);
@@ -0,0 +1,320 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Nathan Osman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <cstring>
+
+#include <QtEndian>
+
+#include "amf.h"
+
+const quint8 MarkerNumber = 0x00;
+const quint8 MarkerBoolean = 0x01;
+const quint8 MarkerString = 0x02;
+const quint8 MarkerObject = 0x03;
+const quint8 MarkerNull = 0x05;
+const quint8 MarkerUndefined = 0x06;
+const quint8 MarkerEcmaArray = 0x08;
+const quint8 MarkerObjectEnd = 0x09;
+const quint8 MarkerStrictArray = 0x0a;
+const quint8 MarkerDate = 0x0b;
+const quint8 MarkerLongString = 0x0c;
+const quint8 MarkerTypedObject = 0x10;
+
+static void appendUInt16(QByteArray &data, quint16 value)
+{
+    value = qToBigEndian<quint16>(value);
+    data.append(reinterpret_cast<const char*>(&value), sizeof (value));
+}
+
+static void appendString(QByteArray &data, const QString &value)
+{
+    const QByteArray utf8 = value.toUtf8();
+    appendUInt16(data, static_cast<quint16>(utf8.size()));
+    data.append(utf8);
+}
+
+void Amf::encode(QByteArray &data, const QVariant &value)
+{
+    switch (static_cast<QMetaType::Type>(value.type())) {
+    case QMetaType::Bool:
+        data.append(static_cast<char>(MarkerBoolean));
+        data.append(static_cast<char>(value.toBool()));
+        break;
+    case QMetaType::Int:
+    case QMetaType::UInt:
+    case QMetaType::LongLong:
+    case QMetaType::ULongLong:
+    case QMetaType::Double:
+    {
+        const double number = value.toDouble();
+        quint64 bits;
+        memcpy(&bits, &number, sizeof (bits));
+        bits = qToBigEndian<quint64>(bits);
+        data.append(static_cast<char>(MarkerNumber));
+        data.append(reinterpret_cast<const char*>(&bits), sizeof (bits));
+        break;
+    }
+    case QMetaType::QString:
+        data.append(static_cast<char>(MarkerString));
+        appendString(data, value.toString());
+        break;
+    case QMetaType::QVariantMap:
+    {
+        const QVariantMap map = value.toMap();
+        data.append(static_cast<char>(MarkerObject));
+        for (auto i = map.constBegin(); i != map.constEnd(); ++i) {
+            appendString(data, i.key());
+            encode(data, i.value());
+        }
+        appendUInt16(data, 0);
+        data.append(static_cast<char>(MarkerObjectEnd));
+        break;
+    }
+    default:
+        data.append(static_cast<char>(MarkerNull));
+        break;
+    }
+}
+
+QByteArray Amf::encode(const QVariantList &values)
+{
+    QByteArray data;
+    foreach (const QVariant &value, values) {
+        encode(data, value);
+    }
+    return data;
+}
+
+namespace {
+
+/**
+ * @brief Sequential reader over an AMF0 buffer
+ */
+class Reader
+{
+public:
+
+    explicit Reader(const QByteArray &data) : mData(data), mOffset(0) {}
+
+    bool atEnd() const { return mOffset >= mData.size(); }
+
+    bool readValue(QVariant &value, int depth = 0);
+
+private:
+
+    bool readBytes(void *dest, int size);
+    bool readNumber(double &value);
+    bool readString(QString &value, bool isLong = false);
+    bool readProperties(QVariantMap &map, int depth);
+
+    const QByteArray &mData;
+    int mOffset;
+};
+
+}
+
+bool Reader::readBytes(void *dest, int size)
+{
+    if (mData.size() - mOffset < size) {
+        return false;
+    }
+    memcpy(dest, mData.constData() + mOffset, size);
+    mOffset += size;
+    return true;
+}
+
+bool Reader::readNumber(double &value)
+{
+    quint64 bits;
+    if (!readBytes(&bits, sizeof (bits))) {
+        return false;
+    }
+    bits = qFromBigEndian<quint64>(bits);
+    memcpy(&value, &bits, sizeof (value));
+    return true;
+}
+
+bool Reader::readString(QString &value, bool isLong)
+{
+    quint32 length;
+    if (isLong) {
+        if (!readBytes(&length, sizeof (length))) {
+            return false;
+        }
+        length = qFromBigEndian<quint32>(length);
+    } else {
+        quint16 shortLength;
+        if (!readBytes(&shortLength, sizeof (shortLength))) {
+            return false;
+        }
+        length = qFromBigEndian<quint16>(shortLength);
+    }
+    if (static_cast<quint32>(mData.size() - mOffset) < length) {
+        return false;
+    }
+    value = QString::fromUtf8(mData.constData() + mOffset, length);
+    mOffset += length;
+    return true;
+}
+
+bool Reader::readProperties(QVariantMap &map, int depth)
+{
+    forever {
+        QString key;
+        if (!readString(key)) {
+            return false;
+        }
+        if (key.isEmpty() && mOffset < mData.size() &&
+                static_cast<quint8>(mData.at(mOffset)) == MarkerObjectEnd) {
+            ++mOffset;
+            return true;
+        }
+        QVariant value;
+        if (!readValue(value, depth + 1)) {
+            return false;
+        }
+        map.insert(key, value);
+    }
+}
+
+bool Reader::readValue(QVariant &value, int depth)
+{
+    // Guard against maliciously nested objects
+    if (depth > 16) {
+        return false;
+    }
+
+    quint8 marker;
+    if (!readBytes(&marker, sizeof (marker))) {
+        return false;
+    }
+
+    switch (marker) {
+    case MarkerNumber:
+    {
+        double number;
+        if (!readNumber(number)) {
+            return false;
+        }
+        value = number;
+        return true;
+    }
+    case MarkerDate:
+    {
+        // The time zone that follows is reserved and always zero
+        double milliseconds;
+        quint16 timeZone;
+        if (!readNumber(milliseconds) || !readBytes(&timeZone, sizeof (timeZone))) {
+            return false;
+        }
+        value = milliseconds;
+        return true;
+    }
+    case MarkerBoolean:
+    {
+        quint8 boolean;
+        if (!readBytes(&boolean, sizeof (boolean))) {
+            return false;
+        }
+        value = boolean != 0;
+        return true;
+    }
+    case MarkerString:
+    case MarkerLongString:
+    {
+        QString string;
+        if (!readString(string, marker == MarkerLongString)) {
+            return false;
+        }
+        value = string;
+        return true;
+    }
+    case MarkerEcmaArray:
+    {
+        // The count is only a hint; the properties are terminated like an object
+        quint32 count;
+        if (!readBytes(&count, sizeof (count))) {
+            return false;
+        }
+    }
+    // fall through
+    case MarkerObject:
+    {
+        QVariantMap map;
+        if (!readProperties(map, depth)) {
+            return false;
+        }
+        value = map;
+        return true;
+    }
+    case MarkerTypedObject:
+    {
+        // Only the properties are kept, not the class name
+        QString className;
+        QVariantMap map;
+        if (!readString(className) || !readProperties(map, depth)) {
+            return false;
+        }
+        value = map;
+        return true;
+    }
+    case MarkerStrictArray:
+    {
+        quint32 count;
+        if (!readBytes(&count, sizeof (count))) {
+            return false;
+        }
+        count = qFromBigEndian<quint32>(count);
+        QVariantList list;
+        for (quint32 i = 0; i < count; ++i) {
+            QVariant item;
+            if (!readValue(item, depth + 1)) {
+                return false;
+            }
+            list.append(item);
+        }
+        value = list;
+        return true;
+    }
+    case MarkerNull:
+    case MarkerUndefined:
+        value = QVariant();
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool Amf::decode(const QByteArray &data, QVariantList &values, int count)
+{
+    Reader reader(data);
+    while (!reader.atEnd() && count--) {
+        QVariant value;
+        if (!reader.readValue(value)) {
+            return false;
+        }
+        values.append(value);
+    }
+    return true;
+}
@@ -0,0 +1,50 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Nathan Osman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef AMF_H
+#define AMF_H
+
+#include <QByteArray>
+#include <QVariant>
+
+/**
+ * @brief Minimal AMF0 encoding and decoding for RTMP commands
+ *
+ * Numbers and dates map to double, strings to QString, booleans to bool,
+ * objects and ECMA arrays to QVariantMap and null / undefined to an invalid
+ * QVariant. Dates are milliseconds since the epoch and typed objects lose
+ * their class name.
+ */
+namespace Amf
+{
+
+void encode(QByteArray &data, const QVariant &value);
+QByteArray encode(const QVariantList &values);
+
+// Decodes at most count values if count is not negative
+bool decode(const QByteArray &data, QVariantList &values, int count = -1);
+
+}
+
+#endif // AMF_H
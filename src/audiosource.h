@@ -0,0 +1,63 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Nathan Osman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef AUDIOSOURCE_H
+#define AUDIOSOURCE_H
+
+#include <QAudioFormat>
+#include <QByteArray>
+#include <QObject>
+#include <QSharedPointer>
+
+#include "log.h"
+
+struct MappedFile;
+
+/**
+ * @brief Producer of raw PCM audio blocks
+ */
+class AudioSource : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    explicit AudioSource(QObject *parent = nullptr);
+
+    static QAudioFormat audioFormat();
+
+signals:
+
+    void log(LogType logType, const QString &message);
+
+    /**
+     * @brief Emitted for each block of audio
+     *
+     * Blocks that point into a mapped file come with the mapping, which
+     * keeps them valid for as long as it is held. Other blocks own their data.
+     */
+    void audioData(const QByteArray &data, const QSharedPointer<MappedFile> &mapping = QSharedPointer<MappedFile>());
+};
+
+#endif // AUDIOSOURCE_H
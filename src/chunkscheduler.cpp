@@ -0,0 +1,172 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Nathan Osman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <QtEndian>
+
+#include "chunkscheduler.h"
+#include "trace.h"
+
+const int DefaultChunkSize = 128;
+const quint32 ExtendedTimestamp = 0xffffff;
+
+const quint8 MessageSetChunkSize = 1;
+
+static void appendBasicHeader(QByteArray &data, quint8 format, quint32 chunkStreamId)
+{
+    if (chunkStreamId < 64) {
+        data.append(static_cast<char>((format << 6) | chunkStreamId));
+    } else if (chunkStreamId < 320) {
+        data.append(static_cast<char>(format << 6));
+        data.append(static_cast<char>(chunkStreamId - 64));
+    } else {
+        data.append(static_cast<char>((format << 6) | 1));
+        data.append(static_cast<char>((chunkStreamId - 64) & 0xff));
+        data.append(static_cast<char>((chunkStreamId - 64) >> 8));
+    }
+}
+
+static void appendUInt24(QByteArray &data, quint32 value)
+{
+    data.append(static_cast<char>((value >> 16) & 0xff));
+    data.append(static_cast<char>((value >> 8) & 0xff));
+    data.append(static_cast<char>(value & 0xff));
+}
+
+static void appendUInt32(QByteArray &data, quint32 value)
+{
+    value = qToBigEndian<quint32>(value);
+    data.append(reinterpret_cast<const char*>(&value), sizeof (value));
+}
+
+const quint32 ChunkScheduler::ControlChunkStreamId;
+
+ChunkScheduler::ChunkScheduler()
+    : mLastChunkStreamId(0)
+    , mChunkSize(DefaultChunkSize)
+{
+}
+
+void ChunkScheduler::enqueue(quint32 chunkStreamId,
+                             quint8 messageTypeId,
+                             quint32 timestamp,
+                             quint32 messageStreamId,
+                             const QByteArray &payload,
+                             quint64 blockId)
+{
+    mQueues[chunkStreamId].enqueue(Message{
+        messageTypeId,
+        timestamp,
+        messageStreamId,
+        payload,
+        0,
+        blockId
+    });
+}
+
+bool ChunkScheduler::nextChunk(QByteArray &data)
+{
+    if (mQueues.isEmpty()) {
+        return false;
+    }
+
+    // Control messages have strict priority, otherwise continue round-robin
+    // from the chunk stream after the one that sent the previous chunk
+    auto queue = mQueues.find(ControlChunkStreamId);
+    if (queue == mQueues.end()) {
+        queue = mQueues.upperBound(mLastChunkStreamId);
+        if (queue == mQueues.end()) {
+            queue = mQueues.begin();
+        }
+        mLastChunkStreamId = queue.key();
+    }
+
+    const quint32 chunkStreamId = queue.key();
+    Message &message = queue.value().head();
+    const bool extended = message.timestamp >= ExtendedTimestamp;
+
+    if (message.offset == 0) {
+        appendBasicHeader(data, 0, chunkStreamId);
+        appendUInt24(data, extended ? ExtendedTimestamp : message.timestamp);
+        appendUInt24(data, static_cast<quint32>(message.payload.size()));
+        data.append(static_cast<char>(message.typeId));
+
+        // The message stream ID is the only little-endian field
+        const quint32 streamId = qToLittleEndian<quint32>(message.streamId);
+        data.append(reinterpret_cast<const char*>(&streamId), sizeof (streamId));
+    } else {
+        appendBasicHeader(data, 3, chunkStreamId);
+    }
+    if (extended) {
+        appendUInt32(data, message.timestamp);
+    }
+
+    const int length = qMin(mChunkSize, message.payload.size() - message.offset);
+    data.append(message.payload.constData() + message.offset, length);
+    message.offset += length;
+
+    if (message.offset == message.payload.size()) {
+
+        // The traced block ends with its last chunk in the caller's batch
+        Trace::flow(message.blockId, Trace::FlowEnd);
+
+        // Chunks after a Set Chunk Size message use the size it announced
+        if (message.typeId == MessageSetChunkSize && message.payload.size() >= 4) {
+            mChunkSize = static_cast<int>(qFromBigEndian<quint32>(
+                reinterpret_cast<const uchar*>(message.payload.constData())) & 0x7fffffff);
+        }
+
+        queue.value().dequeue();
+        if (queue.value().isEmpty()) {
+            mQueues.erase(queue);
+        }
+    }
+
+    return true;
+}
+
+void ChunkScheduler::discardPending(quint32 chunkStreamId)
+{
+    auto queue = mQueues.find(chunkStreamId);
+    if (queue == mQueues.end()) {
+        return;
+    }
+
+    // A message that is partially sent must be completed to keep the chunk
+    // stream valid, but everything behind it can be dropped
+    const Message &head = queue.value().head();
+    if (head.offset) {
+        Message message = head;
+        queue.value().clear();
+        queue.value().enqueue(message);
+    } else {
+        mQueues.erase(queue);
+    }
+}
+
+void ChunkScheduler::clear()
+{
+    mQueues.clear();
+    mLastChunkStreamId = 0;
+    mChunkSize = DefaultChunkSize;
+}
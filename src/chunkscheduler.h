@@ -0,0 +1,83 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Nathan Osman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef CHUNKSCHEDULER_H
+#define CHUNKSCHEDULER_H
+
+#include <QByteArray>
+#include <QMap>
+#include <QQueue>
+
+/**
+ * @brief Splits outgoing RTMP messages into chunks and orders them
+ *
+ * Each chunk stream has its own queue. Protocol control messages (chunk
+ * stream 2) are always sent first so that acknowledgements and ping
+ * responses never wait behind buffered audio; all other chunk streams take
+ * turns one chunk at a time.
+ *
+ * Once a Set Chunk Size message has been emitted, the chunks that follow
+ * use the size it announced.
+ */
+class ChunkScheduler
+{
+public:
+
+    static const quint32 ControlChunkStreamId = 2;
+
+    ChunkScheduler();
+
+    void enqueue(quint32 chunkStreamId,
+                 quint8 messageTypeId,
+                 quint32 timestamp,
+                 quint32 messageStreamId,
+                 const QByteArray &payload,
+                 quint64 blockId = 0);
+
+    inline bool isEmpty() const { return mQueues.isEmpty(); }
+
+    bool nextChunk(QByteArray &data);
+
+    void discardPending(quint32 chunkStreamId);
+    void clear();
+
+private:
+
+    struct Message
+    {
+        quint8 typeId;
+        quint32 timestamp;
+        quint32 streamId;
+        QByteArray payload;
+        int offset;
+        quint64 blockId;
+    };
+
+    QMap<quint32, QQueue<Message>> mQueues;
+    quint32 mLastChunkStreamId;
+
+    int mChunkSize;
+};
+
+#endif // CHUNKSCHEDULER_H
@@ -23,26 +23,50 @@
  */
 
 #include "client.h"
+#include "trace.h"
+
+const quint16 RtmpPort = 1935;
+const quint16 RtmpsPort = 443;
 
 Client::Client(QObject *parent)
+    : Client(Transport::Backend::Qt, parent)
+{
+}
+
+Client::Client(Transport::Backend backend, QObject *parent)
     : QObject(parent)
-    , mProtocol(&mSocket)
+    , mTransport(Transport::create(Transport::fallback(backend)))
+    , mProtocol(mTransport.data())
     , mActive(false)
+    , mTimestampBaseSet(false)
+    , mTimestampBase(0)
 {
-    connect(&mSocket, &QTcpSocket::connected, this, &Client::onConnected);
-    connect(&mSocket, qOverload<QAbstractSocket::SocketError>(&QTcpSocket::error),
-            this, &Client::onSocketError);
+    mTransport->setConnectedCallback([this]() {
+        onConnected();
+    });
+    mTransport->setErrorCallback([this](const QString &errorMessage) {
+        onSocketError(errorMessage);
+    });
+    mTransport->setLogCallback([this](LogType logType, const QString &message) {
+        emit log(logType, message);
+    });
 
     connect(&mProtocol, &Protocol::handshakeCompleted, this, &Client::onHandshakeCompleted);
+    connect(&mProtocol, &Protocol::publishStarted, this, &Client::onPublishStarted);
     connect(&mProtocol, &Protocol::error, this, &Client::onProtocolError);
 }
 
-void Client::start(const QString &hostName)
+void Client::start(const QUrl &url)
 {
     mActive = true;
+    mUrl = url;
+
+    const bool secure = url.scheme() == "rtmps";
+    const QString hostName = url.host();
+    const quint16 port = url.port(secure ? RtmpsPort : RtmpPort);
 
-    emit log(LogType::Info, QString("connecting to %1...").arg(hostName));
-    mSocket.connectToHost(hostName, 1935);
+    emit log(LogType::Info, QString("connecting to %1:%2...").arg(hostName).arg(port));
+    mTransport->connectToHost(hostName, port, secure);
 }
 
 void Client::stop()
@@ -50,12 +74,32 @@ void Client::stop()
     mActive = false;
 
     emit log(LogType::Info, QString("disconnecting from host..."));
-    mSocket.disconnectFromHost();
+
+    // The transport finishes writing pending data before it disconnects
+    mProtocol.deleteStream();
+    mTransport->disconnectFromHost();
+}
+
+void Client::sendAudio(const QByteArray &data, quint32 timestamp, quint64 blockId)
+{
+    TraceSpan span("Client::sendAudio", blockId);
+    Trace::flow(blockId, Trace::FlowStep);
+
+    if (!mProtocol.isPublishing()) {
+        return;
+    }
+
+    // Capture starts before publishing, so the stream begins at zero
+    if (!mTimestampBaseSet) {
+        mTimestampBase = timestamp;
+        mTimestampBaseSet = true;
+    }
+
+    mProtocol.sendAudio(data, timestamp - mTimestampBase, blockId);
 }
 
 void Client::onConnected()
 {
-    emit log(LogType::Success, "connected to host");
     mProtocol.startHandshake();
 }
 
@@ -63,15 +107,39 @@ void Client::onHandshakeCompleted()
 {
     emit log(LogType::Success, "RTMP handshake completed");
 
-    // TODO: send next chunks
+    // The URL path is the application followed by the stream key
+    const QString path = mUrl.path().mid(1);
+    const int separator = path.indexOf('/');
+    const QString app = path.left(separator);
+    const QString streamKey = separator == -1 ? QString() : path.mid(separator + 1);
+
+    QUrl tcUrl(mUrl);
+    tcUrl.setPath(QString("/%1").arg(app));
+
+    mProtocol.publish(app, tcUrl.toString(), streamKey);
+}
+
+void Client::onPublishStarted()
+{
+    emit log(LogType::Success, "publishing stream");
+    mTimestampBaseSet = false;
 }
 
 void Client::onProtocolError(const QString &errorMessage)
 {
-    //...
+    emit log(LogType::Error, errorMessage);
+
+    // The connection cannot be used once the protocol has failed
+    mActive = false;
+    mTransport->disconnectFromHost();
 }
 
-void Client::onSocketError()
+void Client::onSocketError(const QString &errorMessage)
 {
-    //...
+    emit log(LogType::Error, errorMessage);
+
+    // As with protocol errors, the client stops rather than waiting on a
+    // connection that has failed
+    mActive = false;
+    mTransport->disconnectFromHost();
 }
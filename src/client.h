@@ -25,10 +25,13 @@
 #ifndef CLIENT_H
 #define CLIENT_H
 
-#include <QTcpSocket>
+#include <QByteArray>
+#include <QScopedPointer>
+#include <QUrl>
 
 #include "log.h"
 #include "protocol.h"
+#include "transport.h"
 
 /**
  * @brief Implementation of an RTMP client for streaming audio
@@ -40,11 +43,18 @@ class Client : public QObject
 public:
 
     explicit Client(QObject *parent = nullptr);
+    explicit Client(Transport::Backend backend, QObject *parent = nullptr);
 
-    void start(const QString &hostName);
+    void start(const QUrl &url);
     void stop();
 
+    void sendAudio(const QByteArray &data, quint32 timestamp, quint64 blockId = 0);
+
+    inline void setVerifyPeer(bool verifyPeer) { mTransport->setVerifyPeer(verifyPeer); }
+    inline void setTlsOffload(bool tlsOffload) { mTransport->setTlsOffload(tlsOffload); }
+
     inline bool isActive() const { return mActive; }
+    inline bool isPublishing() const { return mProtocol.isPublishing(); }
 
 signals:
 
@@ -52,17 +62,23 @@ signals:
 
 private slots:
 
-    void onConnected();
     void onHandshakeCompleted();
+    void onPublishStarted();
     void onProtocolError(const QString &errorMessage);
-    void onSocketError();
 
 private:
 
-    QTcpSocket mSocket;
+    void onConnected();
+    void onSocketError(const QString &errorMessage);
+
+    QScopedPointer<Transport> mTransport;
     Protocol mProtocol;
 
     bool mActive;
+    QUrl mUrl;
+
+    bool mTimestampBaseSet;
+    quint32 mTimestampBase;
 };
 
 #endif // CLIENT_H
@@ -0,0 +1,430 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Nathan Osman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <QMutexLocker>
+#include <QQueue>
+#include <QThread>
+#include <QWaitCondition>
+#include <QtEndian>
+
+#include "audiosource.h"
+#include "encodepool.h"
+#include "trace.h"
+
+// FLV audio tag headers for 44 kHz, 16-bit, mono, either as linear PCM
+// (little endian) or as ADPCM
+const char PcmTagHeader = 0x3e;
+const char AdpcmTagHeader = 0x1e;
+
+// Each ADPCM block starts over from a raw sample
+const int AdpcmBlockSamples = 4096;
+
+const int AdpcmStepSizes[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41,
+    45, 50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190,
+    209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724,
+    796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272,
+    2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132,
+    7845, 8630, 9493, 10442, 11487, 12635, 13899, 15289, 16818, 18500,
+    20350, 22385, 24623, 27086, 29794, 32767
+};
+
+const int AdpcmIndexChanges[8] = {-1, -1, -1, -1, 2, 4, 6, 8};
+
+// A 2-bit code size, then per block a 16-bit sample and a 6-bit step index
+// followed by a 4-bit code for each of the remaining samples
+inline int adpcmBitCount(int sampleCount)
+{
+    const int blockCount = (sampleCount + AdpcmBlockSamples - 1) / AdpcmBlockSamples;
+    return 2 + blockCount * 22 + (sampleCount - blockCount) * 4;
+}
+
+struct Frame
+{
+    QByteArray data;
+    quint32 timestamp;
+    quint64 blockId;
+
+    // Keeps data valid if it points into a mapped file
+    QSharedPointer<MappedFile> mapping;
+};
+
+struct EncodeStream
+{
+    int id;
+
+    QMutex mutex;
+    QQueue<Frame> frames;
+    bool scheduled;
+
+    EncodePool::Codec codec;
+    quint64 bytesSubmitted;
+
+    // Worker whose queue the stream joins when it has frames again
+    int worker;
+
+    // Only touched by the worker that is encoding the stream
+    EncodePool::AdpcmState adpcmState;
+};
+
+/**
+ * @brief Pool thread with its own queue of streams that are ready
+ */
+class EncodeWorker : public QThread
+{
+public:
+
+    EncodeWorker(EncodePool *pool, int index) : sleeping(false), mPool(pool), mIndex(index) {}
+
+    QMutex mutex;
+    QQueue<QSharedPointer<EncodeStream>> streams;
+
+    // Guarded by the pool's idle mutex
+    QWaitCondition wake;
+    bool sleeping;
+
+protected:
+
+    virtual void run() { mPool->work(mIndex); }
+
+private:
+
+    EncodePool *mPool;
+    int mIndex;
+};
+
+/**
+ * @brief Packs values into bytes, most significant bit first
+ */
+class BitWriter
+{
+public:
+
+    explicit BitWriter(QByteArray &data) : mData(data), mBits(0), mCount(0) {}
+
+    void write(int count, quint32 value)
+    {
+        mBits = (mBits << count) | (value & ((1u << count) - 1));
+        mCount += count;
+        while (mCount >= 8) {
+            mCount -= 8;
+            mData.append(static_cast<char>(mBits >> mCount));
+        }
+    }
+
+    void flush()
+    {
+        if (mCount) {
+            mData.append(static_cast<char>(mBits << (8 - mCount)));
+            mCount = 0;
+        }
+    }
+
+private:
+
+    QByteArray &mData;
+    quint32 mBits;
+    int mCount;
+};
+
+EncodePool::EncodePool(QObject *parent)
+    : QObject(parent)
+    , mReadyCount(0)
+    , mSleepingCount(0)
+    , mStopping(false)
+    , mNextStreamId(1)
+{
+}
+
+EncodePool::~EncodePool()
+{
+    // Workers finish every stream that is still queued before they exit
+    {
+        QMutexLocker locker(&mIdleMutex);
+        mStopping = true;
+        for (EncodeWorker *worker : mWorkers) {
+            worker->wake.wakeOne();
+        }
+    }
+    for (EncodeWorker *worker : mWorkers) {
+        worker->wait();
+    }
+    qDeleteAll(mWorkers);
+}
+
+int EncodePool::addStream(Codec codec)
+{
+    QSharedPointer<EncodeStream> stream(new EncodeStream);
+    stream->scheduled = false;
+    stream->codec = codec;
+    stream->bytesSubmitted = 0;
+
+    QMutexLocker locker(&mMutex);
+    stream->id = mNextStreamId++;
+    mStreams.insert(stream->id, stream);
+
+    // Threads are only started once there is something for them to encode
+    if (codec != Codec::Pcm) {
+        if (mWorkers.isEmpty()) {
+            startWorkers();
+        }
+        stream->worker = stream->id % mWorkers.count();
+    }
+
+    return stream->id;
+}
+
+void EncodePool::removeStream(int streamId)
+{
+    // A task already running keeps its own reference to the stream
+    QMutexLocker locker(&mMutex);
+    mStreams.remove(streamId);
+}
+
+void EncodePool::submit(int streamId, const QByteArray &frame, const QSharedPointer<MappedFile> &mapping)
+{
+    QMutexLocker poolLocker(&mMutex);
+    QSharedPointer<EncodeStream> stream = mStreams.value(streamId);
+    poolLocker.unlock();
+
+    if (!stream) {
+        return;
+    }
+
+    QMutexLocker locker(&stream->mutex);
+
+    // Timestamps are derived from the amount of audio so they never drift
+    const QAudioFormat audioFormat = AudioSource::audioFormat();
+    const quint64 bytesPerSecond = audioFormat.sampleRate() * audioFormat.bytesPerFrame();
+    const quint32 timestamp = static_cast<quint32>(stream->bytesSubmitted * 1000 / bytesPerSecond);
+    stream->bytesSubmitted += frame.size();
+
+    // The flow starts in the span of the source that emitted the frame
+    const quint64 blockId = Trace::newBlockId();
+    Trace::flow(blockId, Trace::FlowStart);
+
+    if (stream->codec == Codec::Pcm) {
+        locker.unlock();
+
+        // Adding the tag header costs less than handing the frame over
+        TraceSpan span("EncodePool::encode", blockId);
+        Trace::flow(blockId, Trace::FlowStep);
+        emit encoded(stream->id, encode(frame), timestamp, blockId);
+        return;
+    }
+
+    stream->frames.enqueue(Frame{frame, timestamp, blockId, mapping});
+    if (!stream->scheduled) {
+        stream->scheduled = true;
+        schedule(stream);
+    }
+}
+
+void EncodePool::startWorkers()
+{
+    const int count = qMax(1, QThread::idealThreadCount());
+    for (int i = 0; i < count; ++i) {
+        EncodeWorker *worker = new EncodeWorker(this, i);
+        worker->setObjectName(QString("EncodePool %1").arg(i));
+        mWorkers.append(worker);
+    }
+    for (EncodeWorker *worker : mWorkers) {
+        worker->start();
+    }
+}
+
+void EncodePool::schedule(const QSharedPointer<EncodeStream> &stream)
+{
+    EncodeWorker *home = mWorkers.at(stream->worker);
+    {
+        QMutexLocker locker(&home->mutex);
+        home->streams.enqueue(stream);
+    }
+    ++mReadyCount;
+
+    // A sleeping worker checks the ready count after announcing that it is
+    // going to sleep, so one of the two always sees the other
+    if (!mSleepingCount) {
+        return;
+    }
+
+    // The stream's own worker is preferred; any other will steal it
+    QMutexLocker locker(&mIdleMutex);
+    EncodeWorker *sleeper = home->sleeping ? home : nullptr;
+    for (int i = 0; !sleeper && i < mWorkers.count(); ++i) {
+        if (mWorkers.at(i)->sleeping) {
+            sleeper = mWorkers.at(i);
+        }
+    }
+    if (sleeper) {
+        sleeper->sleeping = false;
+        sleeper->wake.wakeOne();
+    }
+}
+
+void EncodePool::work(int workerIndex)
+{
+    EncodeWorker *worker = mWorkers.at(workerIndex);
+    bool named = false;
+
+    forever {
+        QSharedPointer<EncodeStream> stream = take(workerIndex);
+        if (stream) {
+            if (!named && Trace::isEnabled()) {
+                Trace::setThreadName(worker->objectName());
+                named = true;
+            }
+            encodeQueued(stream, workerIndex);
+            continue;
+        }
+
+        QMutexLocker locker(&mIdleMutex);
+        if (mStopping && !mReadyCount) {
+            return;
+        }
+
+        ++mSleepingCount;
+        worker->sleeping = true;
+        while (!mReadyCount && worker->sleeping && !mStopping) {
+            worker->wake.wait(&mIdleMutex);
+        }
+        worker->sleeping = false;
+        --mSleepingCount;
+    }
+}
+
+QSharedPointer<EncodeStream> EncodePool::take(int workerIndex)
+{
+    if (!mReadyCount) {
+        return QSharedPointer<EncodeStream>();
+    }
+
+    // The worker's own queue comes first, then the others in turn; streams
+    // are taken oldest first either way, since those have waited longest
+    const int count = mWorkers.count();
+    for (int i = 0; i < count; ++i) {
+        EncodeWorker *worker = mWorkers.at((workerIndex + i) % count);
+        QMutexLocker locker(&worker->mutex);
+        if (!worker->streams.isEmpty()) {
+            --mReadyCount;
+            return worker->streams.dequeue();
+        }
+    }
+
+    return QSharedPointer<EncodeStream>();
+}
+
+void EncodePool::encodeQueued(const QSharedPointer<EncodeStream> &stream, int workerIndex)
+{
+    forever {
+        QQueue<Frame> frames;
+        {
+            QMutexLocker locker(&stream->mutex);
+
+            // A stolen stream stays with its new worker from now on
+            stream->worker = workerIndex;
+            if (stream->frames.isEmpty()) {
+                stream->scheduled = false;
+                return;
+            }
+            frames.swap(stream->frames);
+        }
+
+        foreach (const Frame &frame, frames) {
+            TraceSpan span("EncodePool::encode", frame.blockId);
+            Trace::flow(frame.blockId, Trace::FlowStep);
+            emit encoded(stream->id, encodeAdpcm(frame.data, stream->adpcmState),
+                         frame.timestamp, frame.blockId);
+        }
+    }
+}
+
+QByteArray EncodePool::encode(const QByteArray &frame)
+{
+    QByteArray data;
+    data.reserve(frame.size() + 1);
+    data.append(PcmTagHeader);
+    data.append(frame);
+    return data;
+}
+
+QByteArray EncodePool::encodeAdpcm(const QByteArray &frame, AdpcmState &state)
+{
+    const QByteArray input = state.remainder.isEmpty() ? frame : state.remainder + frame;
+    const uchar *samples = reinterpret_cast<const uchar*>(input.constData());
+
+    int count = input.size() / 2;
+    if (adpcmBitCount(count) % 8 == 4) {
+        --count;
+    }
+    // Copied, since the frame may point into a mapping that is released next
+    state.remainder = QByteArray(input.constData() + count * 2, input.size() - count * 2);
+
+    int &stepIndex = state.stepIndex;
+
+    QByteArray data;
+    data.reserve(1 + (adpcmBitCount(count) + 7) / 8);
+    data.append(AdpcmTagHeader);
+
+    BitWriter writer(data);
+    writer.write(2, 2);
+
+    int predicted = 0;
+    for (int i = 0; i < count; ++i) {
+        const int sample = qFromLittleEndian<qint16>(samples + i * 2);
+
+        if (i % AdpcmBlockSamples == 0) {
+            writer.write(16, static_cast<quint16>(sample));
+            writer.write(6, static_cast<quint32>(stepIndex));
+            predicted = sample;
+            continue;
+        }
+
+        // Quantize the difference exactly as the decoder will rebuild it, so
+        // that the prediction on both ends stays the same
+        int step = AdpcmStepSizes[stepIndex];
+        int difference = sample - predicted;
+        int code = 0;
+        if (difference < 0) {
+            code = 8;
+            difference = -difference;
+        }
+
+        int rebuilt = step >> 3;
+        for (int bit = 4; bit; bit >>= 1, step >>= 1) {
+            if (difference >= step) {
+                code |= bit;
+                difference -= step;
+                rebuilt += step;
+            }
+        }
+
+        predicted = qBound(-32768, predicted + (code & 8 ? -rebuilt : rebuilt), 32767);
+        stepIndex = qBound(0, stepIndex + AdpcmIndexChanges[code & 7], 88);
+        writer.write(4, static_cast<quint32>(code));
+    }
+
+    writer.flush();
+    return data;
+}
@@ -0,0 +1,124 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Nathan Osman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef ENCODEPOOL_H
+#define ENCODEPOOL_H
+
+#include <atomic>
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QObject>
+#include <QSharedPointer>
+
+class EncodeWorker;
+struct EncodeStream;
+struct MappedFile;
+
+/**
+ * @brief Encodes audio frames from many streams on a shared thread pool
+ *
+ * PCM only needs a tag header in front of each frame, so PCM streams are
+ * encoded directly in submit(); a trip through the pool would only add
+ * latency. ADPCM streams are compressed on the pool. The Recorder's stream
+ * is PCM, so captured audio never reaches the pool's workers.
+ *
+ * Each pooled stream has its own queue of frames and is handed to a worker
+ * only while it has work. Every worker keeps a queue of ready streams, and
+ * a stream goes back to the worker that encoded it last so that its state
+ * stays in that core's cache. A worker with an empty queue steals from the
+ * others. Frames that accumulate while a stream waits are encoded together,
+ * and only one worker handles a stream at a time, which keeps each stream's
+ * output in order.
+ *
+ * Frames for a stream must be submitted from a single thread. A frame that
+ * points into a mapped file must be submitted with the mapping, which is
+ * held until the frame has been encoded.
+ */
+class EncodePool : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    enum class Codec {
+        Pcm,
+        Adpcm
+    };
+
+    explicit EncodePool(QObject *parent = nullptr);
+    virtual ~EncodePool();
+
+    int addStream(Codec codec = Codec::Pcm);
+    void removeStream(int streamId);
+
+    void submit(int streamId, const QByteArray &frame, const QSharedPointer<MappedFile> &mapping = QSharedPointer<MappedFile>());
+
+    /**
+     * @brief State of an ADPCM stream from one frame to the next
+     *
+     * The step index carries over so that each frame starts with a step size
+     * suited to the signal. A sample that would leave half a byte of padding
+     * at the end of a tag is held back for the next one, since decoders read
+     * such padding as one more sample.
+     */
+    struct AdpcmState
+    {
+        int stepIndex = 0;
+        QByteArray remainder;
+    };
+
+    static QByteArray encode(const QByteArray &frame);
+    static QByteArray encodeAdpcm(const QByteArray &frame, AdpcmState &state);
+
+signals:
+
+    void encoded(int streamId, const QByteArray &data, quint32 timestamp, quint64 blockId);
+
+private:
+
+    friend class EncodeWorker;
+
+    void startWorkers();
+    void schedule(const QSharedPointer<EncodeStream> &stream);
+    void work(int workerIndex);
+    QSharedPointer<EncodeStream> take(int workerIndex);
+    void encodeQueued(const QSharedPointer<EncodeStream> &stream, int workerIndex);
+
+    QList<EncodeWorker*> mWorkers;
+
+    // Workers sleep on this while no stream is ready anywhere
+    QMutex mIdleMutex;
+    std::atomic<int> mReadyCount;
+    std::atomic<int> mSleepingCount;
+    bool mStopping;
+
+    QMutex mMutex;
+    QHash<int, QSharedPointer<EncodeStream>> mStreams;
+    int mNextStreamId;
+};
+
+#endif // ENCODEPOOL_H
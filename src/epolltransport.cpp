@@ -0,0 +1,275 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Nathan Osman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <cerrno>
+
+#include <limits.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <QScopedPointer>
+#include <QSocketNotifier>
+
+#include "epolltransport.h"
+#include "trace.h"
+
+const int MaxIovecs = IOV_MAX < 64 ? IOV_MAX : 64;
+
+EpollLoop *EpollLoop::instance()
+{
+    static thread_local QScopedPointer<EpollLoop> loop;
+    if (!loop) {
+        loop.reset(new EpollLoop);
+    }
+    return loop.data();
+}
+
+EpollLoop::EpollLoop()
+    : mFd(epoll_create1(EPOLL_CLOEXEC))
+    , mNotifier(nullptr)
+    , mEventCount(0)
+    , mSyscallCount(0)
+{
+    if (mFd != -1) {
+        mNotifier = new QSocketNotifier(mFd, QSocketNotifier::Read, this);
+        connect(mNotifier, qOverload<int>(&QSocketNotifier::activated),
+                this, &EpollLoop::processEvents);
+    }
+}
+
+EpollLoop::~EpollLoop()
+{
+    if (mFd != -1) {
+        close(mFd);
+    }
+}
+
+void EpollLoop::processEvents()
+{
+    // Keep going while full batches are returned
+    do {
+        ++mSyscallCount;
+        mEventCount = epoll_wait(mFd, mEvents, MaxEvents, 0);
+        if (mEventCount <= 0) {
+            mEventCount = 0;
+            return;
+        }
+
+        for (int i = 0; i < mEventCount; ++i) {
+
+            // Entries are cleared when their transport goes away mid-batch
+            EpollTransport *transport = static_cast<EpollTransport*>(mEvents[i].data.ptr);
+            if (transport) {
+                transport->onEvents(mEvents[i].events);
+            }
+        }
+    } while (mEventCount == MaxEvents);
+
+    mEventCount = 0;
+}
+
+bool EpollLoop::control(int operation, EpollTransport *transport, quint32 events)
+{
+    epoll_event event{};
+    event.events = events;
+    event.data.ptr = transport;
+
+    ++mSyscallCount;
+    if (epoll_ctl(mFd, operation, transport->socket(), &event) == -1) {
+        return false;
+    }
+
+    // Forget events for the transport that are still waiting in this batch
+    if (operation == EPOLL_CTL_DEL) {
+        for (int i = 0; i < mEventCount; ++i) {
+            if (mEvents[i].data.ptr == transport) {
+                mEvents[i].data.ptr = nullptr;
+            }
+        }
+    }
+
+    return true;
+}
+
+EpollTransport::EpollTransport(EpollLoop *loop)
+    : mLoop(loop)
+    , mAttached(false)
+    , mReceiving(false)
+    , mWatchReadable(false)
+    , mWatchWritable(false)
+    , mSendBlocked(false)
+    , mInterest(0)
+{
+}
+
+EpollTransport::~EpollTransport()
+{
+    closeSocket();
+}
+
+bool EpollTransport::attachSocket()
+{
+    mReceiving = false;
+    mWatchReadable = false;
+    mWatchWritable = false;
+    mSendBlocked = false;
+    mInterest = 0;
+
+    mAttached = mLoop->control(EPOLL_CTL_ADD, this, 0);
+    return mAttached;
+}
+
+void EpollTransport::detachSocket()
+{
+    if (mAttached) {
+        mLoop->control(EPOLL_CTL_DEL, this, 0);
+        mAttached = false;
+    }
+    close(socket());
+}
+
+void EpollTransport::watch(bool readable, bool writable)
+{
+    mWatchReadable |= readable;
+    mWatchWritable |= writable;
+    updateInterest();
+}
+
+void EpollTransport::startReceiving()
+{
+    mReceiving = true;
+    updateInterest();
+}
+
+void EpollTransport::startSending()
+{
+    if (mSendBlocked) {
+        return;
+    }
+
+    TraceSpan span("EpollTransport::write");
+
+    iovec iov[MaxIovecs];
+
+    while (mAttached && bytesToWrite()) {
+        msghdr message{};
+        message.msg_iov = iov;
+        message.msg_iovlen = pendingIovecs(iov, MaxIovecs);
+
+        // This is writev() without SIGPIPE when the peer has gone away
+        ++mLoop->mSyscallCount;
+        const ssize_t size = sendmsg(socket(), &message, MSG_NOSIGNAL);
+        if (size == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                mSendBlocked = true;
+                updateInterest();
+            } else {
+                onClosed(errno);
+            }
+            return;
+        }
+
+        onSent(size);
+    }
+}
+
+void EpollTransport::onEvents(quint32 events)
+{
+    // Data that arrived before a hangup (such as a final error message from
+    // the server) is delivered before the hangup itself is reported
+    if (events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+        if (mReceiving) {
+            receive();
+        } else if (mWatchReadable && (events & EPOLLIN)) {
+            mWatchReadable = false;
+            updateInterest();
+            onReady(true, false);
+        }
+    }
+
+    if (mAttached && (events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+        if (mWatchWritable) {
+            mWatchWritable = false;
+            updateInterest();
+            onReady(false, true);
+
+            // Any error has been read from the socket by now, and a failed
+            // connection may already have moved on to the next address
+            return;
+        } else if (mSendBlocked) {
+            mSendBlocked = false;
+            updateInterest();
+            startSending();
+        }
+    }
+
+    if (mAttached && (events & (EPOLLERR | EPOLLHUP))) {
+        int errorCode = 0;
+        socklen_t length = sizeof (errorCode);
+        getsockopt(socket(), SOL_SOCKET, SO_ERROR, &errorCode, &length);
+        onClosed(errorCode ? errorCode : ECONNRESET);
+    }
+}
+
+void EpollTransport::receive()
+{
+    // Spans are handed over directly from the shared buffer; the loop is
+    // single-threaded so the buffer cannot be reused during the callback
+    while (mAttached) {
+        ++mLoop->mSyscallCount;
+        const ssize_t size = recv(socket(), mLoop->mReadBuffer, EpollLoop::ReadBufferSize, 0);
+        if (size > 0) {
+            onReceived(mLoop->mReadBuffer, size);
+        } else if (size == 0) {
+            onClosed(0);
+        } else if (errno != EINTR) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                onClosed(errno);
+            }
+            return;
+        }
+    }
+}
+
+void EpollTransport::updateInterest()
+{
+    const quint32 interest =
+            (mReceiving || mWatchReadable ? static_cast<quint32>(EPOLLIN) : 0) |
+            (mWatchWritable || mSendBlocked ? static_cast<quint32>(EPOLLOUT) : 0);
+
+    if (!mAttached || interest == mInterest) {
+        return;
+    }
+
+    if (!mLoop->control(EPOLL_CTL_MOD, this, interest)) {
+        onClosed(errno);
+        return;
+    }
+
+    mInterest = interest;
+}
@@ -0,0 +1,124 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Nathan Osman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef EPOLLTRANSPORT_H
+#define EPOLLTRANSPORT_H
+
+#include <sys/epoll.h>
+
+#include <QObject>
+
+#include "sockettransport.h"
+
+class QSocketNotifier;
+
+class EpollTransport;
+
+/**
+ * @brief Per-thread epoll instance driving any number of EpollTransports
+ *
+ * The epoll descriptor is watched by a QSocketNotifier, so events are
+ * dispatched from the thread's Qt event loop in a single batch rather than
+ * through a signal per socket. All transports share one receive buffer.
+ */
+class EpollLoop : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    static EpollLoop *instance();
+
+    EpollLoop();
+    virtual ~EpollLoop();
+
+    inline bool isValid() const { return mFd != -1; }
+    inline int fd() const { return mFd; }
+
+    inline quint64 syscallCount() const { return mSyscallCount; }
+
+    void processEvents();
+
+private:
+
+    friend class EpollTransport;
+
+    static const int MaxEvents = 64;
+    static const int ReadBufferSize = 65536;
+
+    bool control(int operation, EpollTransport *transport, quint32 events);
+
+    int mFd;
+    QSocketNotifier *mNotifier;
+
+    epoll_event mEvents[MaxEvents];
+    int mEventCount;
+
+    quint64 mSyscallCount;
+
+    char mReadBuffer[ReadBufferSize];
+};
+
+/**
+ * @brief Transport for a socket using epoll
+ *
+ * Queued writes are submitted with a single sendmsg() call on flush(). Data
+ * that cannot be written immediately is retained and sent once the socket
+ * becomes writable again.
+ */
+class EpollTransport : public SocketTransport
+{
+public:
+
+    explicit EpollTransport(EpollLoop *loop);
+    virtual ~EpollTransport();
+
+protected:
+
+    virtual bool attachSocket();
+    virtual void detachSocket();
+    virtual void watch(bool readable, bool writable);
+    virtual void startReceiving();
+    virtual void startSending();
+
+private:
+
+    friend class EpollLoop;
+
+    void onEvents(quint32 events);
+    void receive();
+    void updateInterest();
+
+    EpollLoop *mLoop;
+    bool mAttached;
+
+    bool mReceiving;
+    bool mWatchReadable;
+    bool mWatchWritable;
+    bool mSendBlocked;
+
+    quint32 mInterest;
+};
+
+#endif // EPOLLTRANSPORT_H
@@ -0,0 +1,247 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Nathan Osman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <cstring>
+
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWeakPointer>
+#include <QtEndian>
+
+#include "filesource.h"
+#include "trace.h"
+
+// Blocks are emitted in 20ms increments, similar to a capture device
+const int BlockDuration = 20;
+
+struct MappedFile
+{
+    explicit MappedFile(const QString &fileName)
+        : file(fileName)
+        , data(nullptr)
+        , size(0)
+    {
+    }
+
+    QFile file;
+    const char *data;
+    qint64 size;
+};
+
+// Mappings currently in use, keyed by canonical path
+static QHash<QString, QWeakPointer<MappedFile>> mappedFiles;
+static QMutex mappedFilesMutex;
+
+inline quint16 readUInt16(const uchar *data)
+{
+    return qFromLittleEndian<quint16>(data);
+}
+
+inline quint32 readUInt32(const uchar *data)
+{
+    return qFromLittleEndian<quint32>(data);
+}
+
+/**
+ * @brief Locate the PCM samples in a mapped file
+ * @return error message or an empty string on success
+ */
+static QString findSamples(MappedFile *mappedFile, const uchar *begin, qint64 size)
+{
+    // Anything that is not a RIFF file is treated as raw PCM
+    if (size < 12 || memcmp(begin, "RIFF", 4) || memcmp(begin + 8, "WAVE", 4)) {
+        mappedFile->data = reinterpret_cast<const char*>(begin);
+        mappedFile->size = size;
+        return QString();
+    }
+
+    const QAudioFormat audioFormat = AudioSource::audioFormat();
+    bool formatFound = false;
+
+    qint64 offset = 12;
+    while (offset + 8 <= size) {
+        const uchar *chunk = begin + offset;
+        const qint64 chunkSize = readUInt32(chunk + 4);
+        const qint64 available = qMin(chunkSize, size - offset - 8);
+
+        if (!memcmp(chunk, "fmt ", 4)) {
+            if (available < 16) {
+                return QObject::tr("malformed WAV format chunk");
+            }
+            if (readUInt16(chunk + 8) != 1 ||
+                    readUInt16(chunk + 10) != audioFormat.channelCount() ||
+                    static_cast<int>(readUInt32(chunk + 12)) != audioFormat.sampleRate() ||
+                    readUInt16(chunk + 22) != audioFormat.sampleSize()) {
+                return QObject::tr("WAV file must be %1 Hz, %2 channel, %3-bit PCM")
+                        .arg(audioFormat.sampleRate())
+                        .arg(audioFormat.channelCount())
+                        .arg(audioFormat.sampleSize());
+            }
+            formatFound = true;
+        } else if (!memcmp(chunk, "data", 4)) {
+            if (!formatFound) {
+                return QObject::tr("WAV data chunk precedes format chunk");
+            }
+            mappedFile->data = reinterpret_cast<const char*>(chunk + 8);
+            mappedFile->size = available;
+            return QString();
+        }
+
+        // Chunks are padded to an even number of bytes
+        offset += 8 + chunkSize + (chunkSize & 1);
+    }
+
+    return QObject::tr("WAV file contains no data chunk");
+}
+
+FileSource::FileSource(QObject *parent)
+    : AudioSource(parent)
+    , mRealTime(true)
+    , mLooping(true)
+    , mPosition(0)
+    , mBytesEmitted(0)
+{
+    connect(&mTimer, &QTimer::timeout, this, &FileSource::onTimeout);
+}
+
+bool FileSource::open(const QString &fileName)
+{
+    stop();
+    mFile.clear();
+
+    // Different paths to the same file share its mapping
+    const QString canonicalPath = QFileInfo(fileName).canonicalFilePath();
+    if (canonicalPath.isEmpty()) {
+        emit log(LogType::Error, QString("%1: file does not exist").arg(fileName));
+        return false;
+    }
+
+    QMutexLocker locker(&mappedFilesMutex);
+
+    // Drop the entries of mappings that are no longer in use
+    for (auto i = mappedFiles.begin(); i != mappedFiles.end();) {
+        if (i.value().isNull()) {
+            i = mappedFiles.erase(i);
+        } else {
+            ++i;
+        }
+    }
+
+    // Reuse an existing mapping of the file if there is one
+    QSharedPointer<MappedFile> mappedFile = mappedFiles.value(canonicalPath).toStrongRef();
+    if (mappedFile) {
+        mFile = mappedFile;
+        return true;
+    }
+
+    mappedFile.reset(new MappedFile(canonicalPath));
+    if (!mappedFile->file.open(QIODevice::ReadOnly)) {
+        emit log(LogType::Error, mappedFile->file.errorString());
+        return false;
+    }
+
+    const qint64 size = mappedFile->file.size();
+    const uchar *begin = mappedFile->file.map(0, size);
+    if (!begin) {
+        emit log(LogType::Error, mappedFile->file.errorString());
+        return false;
+    }
+
+    QString errorMessage = findSamples(mappedFile.data(), begin, size);
+    if (!errorMessage.isEmpty()) {
+        emit log(LogType::Error, QString("%1: %2").arg(fileName).arg(errorMessage));
+        return false;
+    }
+
+    // Only emit whole samples
+    const int sampleBytes = audioFormat().bytesPerFrame();
+    mappedFile->size -= mappedFile->size % sampleBytes;
+    if (!mappedFile->size) {
+        emit log(LogType::Error, QString("%1: no audio data").arg(fileName));
+        return false;
+    }
+
+    mappedFiles.insert(canonicalPath, mappedFile);
+    mFile = mappedFile;
+
+    return true;
+}
+
+void FileSource::start(bool realTime)
+{
+    if (!mFile) {
+        return;
+    }
+
+    mRealTime = realTime;
+    mPosition = 0;
+    mBytesEmitted = 0;
+
+    // When not pacing, a zero timeout emits one block per event loop pass
+    mTimer.start(mRealTime ? BlockDuration : 0);
+    mElapsedTimer.start();
+}
+
+void FileSource::stop()
+{
+    mTimer.stop();
+}
+
+void FileSource::onTimeout()
+{
+    const qint64 blockSize = audioFormat().bytesForDuration(BlockDuration * 1000);
+
+    if (!mRealTime) {
+        emitBlock(blockSize);
+        return;
+    }
+
+    // Catch up with the wall clock, which also absorbs timer jitter
+    const qint64 target = audioFormat().bytesForDuration(mElapsedTimer.elapsed() * 1000);
+    while (mTimer.isActive() && mBytesEmitted + blockSize <= target) {
+        emitBlock(blockSize);
+    }
+}
+
+void FileSource::emitBlock(qint64 size)
+{
+    TraceSpan span("FileSource::audioData");
+
+    const qint64 length = qMin(size, mFile->size - mPosition);
+
+    emit audioData(QByteArray::fromRawData(mFile->data + mPosition, static_cast<int>(length)), mFile);
+
+    mBytesEmitted += length;
+    mPosition += length;
+
+    if (mPosition == mFile->size) {
+        mPosition = 0;
+        if (!mLooping) {
+            stop();
+        }
+    }
+}
@@ -0,0 +1,78 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Nathan Osman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef FILESOURCE_H
+#define FILESOURCE_H
+
+#include <QElapsedTimer>
+#include <QSharedPointer>
+#include <QTimer>
+
+#include "audiosource.h"
+
+struct MappedFile;
+
+/**
+ * @brief Audio source that plays back a memory-mapped WAV or raw PCM file
+ *
+ * Sources opening the same file share a single mapping and emit blocks that
+ * point directly into it, so feeds do not copy the audio. Each block is
+ * emitted with the mapping; receivers that queue blocks, such as EncodePool,
+ * hold on to it instead of copying the audio.
+ */
+class FileSource : public AudioSource
+{
+    Q_OBJECT
+
+public:
+
+    explicit FileSource(QObject *parent = nullptr);
+
+    bool open(const QString &fileName);
+
+    void start(bool realTime = true);
+    void stop();
+
+    inline void setLooping(bool looping) { mLooping = looping; }
+
+private slots:
+
+    void onTimeout();
+
+private:
+
+    void emitBlock(qint64 size);
+
+    QSharedPointer<MappedFile> mFile;
+    QTimer mTimer;
+    QElapsedTimer mElapsedTimer;
+
+    bool mRealTime;
+    bool mLooping;
+
+    qint64 mPosition;
+    qint64 mBytesEmitted;
+};
+
+#endif // FILESOURCE_H
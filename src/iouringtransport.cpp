@@ -0,0 +1,582 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Nathan Osman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <cerrno>
+#include <cstring>
+
+#include <limits.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <QScopedPointer>
+#include <QSocketNotifier>
+#include <QTimer>
+#include <QVector>
+
+#include "iouringtransport.h"
+#include "trace.h"
+
+const int MaxIovecs = IOV_MAX < 64 ? IOV_MAX : 64;
+
+// The operation is stored in the low bits of the (aligned) handle pointer
+const quint64 OperationMask = 7;
+
+/**
+ * @brief State shared between a transport and the operations it has in flight
+ *
+ * The handle outlives its transport until the kernel has completed every
+ * operation, since those reference the buffers held here.
+ */
+struct IoUringLoop::Handle
+{
+    IoUringTransport *transport;
+    int fd;
+
+    int inflight;
+    int operations;
+
+    int buffer;
+    char *data;
+    QByteArray fallback;
+
+    QList<QByteArray> sending;
+    iovec iov[MaxIovecs];
+    msghdr message;
+};
+
+inline int operationBit(int operation)
+{
+    return 1 << operation;
+}
+
+IoUringLoop *IoUringLoop::instance()
+{
+    static thread_local QScopedPointer<IoUringLoop> loop;
+    if (!loop) {
+        loop.reset(new IoUringLoop);
+    }
+    return loop.data();
+}
+
+IoUringLoop::IoUringLoop()
+    : mFd(-1)
+    , mNotifier(nullptr)
+    , mSubmissionRing(MAP_FAILED)
+    , mSubmissionRingSize(0)
+    , mCompletionRing(MAP_FAILED)
+    , mCompletionRingSize(0)
+    , mSubmissionEntries(static_cast<io_uring_sqe*>(MAP_FAILED))
+    , mSubmissionHead(nullptr)
+    , mSubmissionTail(nullptr)
+    , mSubmissionFlags(nullptr)
+    , mSubmissionArray(nullptr)
+    , mSubmissionMask(0)
+    , mSubmissionCount(0)
+    , mQueuedTail(0)
+    , mCompletionHead(nullptr)
+    , mCompletionTail(nullptr)
+    , mCompletionMask(0)
+    , mCompletionEntries(nullptr)
+    , mSubmitScheduled(false)
+    , mBuffers(nullptr)
+    , mBufferCount(0)
+    , mSyscallCount(0)
+{
+    if (!setup()) {
+        teardown();
+        return;
+    }
+
+    registerBuffers();
+
+    mNotifier = new QSocketNotifier(mFd, QSocketNotifier::Read, this);
+    connect(mNotifier, qOverload<int>(&QSocketNotifier::activated),
+            this, &IoUringLoop::processEvents);
+}
+
+IoUringLoop::~IoUringLoop()
+{
+    // Closing the ring cancels whatever is still in flight
+    teardown();
+
+    for (Handle *handle : mHandles) {
+        delete handle;
+    }
+}
+
+void IoUringLoop::processEvents()
+{
+    forever {
+        unsigned head = *mCompletionHead;
+        const unsigned tail = __atomic_load_n(mCompletionTail, __ATOMIC_ACQUIRE);
+
+        if (head == tail) {
+
+            // Completions that did not fit into the ring are kept by the
+            // kernel and copied over during the next io_uring_enter()
+            if (__atomic_load_n(mSubmissionFlags, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW) {
+                enter(0, IORING_ENTER_GETEVENTS);
+                if (__atomic_load_n(mCompletionTail, __ATOMIC_ACQUIRE) != tail) {
+                    continue;
+                }
+            }
+            break;
+        }
+
+        for (; head != tail; ++head) {
+
+            // Release the slot before dispatching, which may queue more work
+            const io_uring_cqe cqe = mCompletionEntries[head & mCompletionMask];
+            __atomic_store_n(mCompletionHead, head + 1, __ATOMIC_RELEASE);
+            complete(cqe);
+        }
+    }
+
+    submit();
+}
+
+void IoUringLoop::submit()
+{
+    mSubmitScheduled = false;
+
+    __atomic_store_n(mSubmissionTail, mQueuedTail, __ATOMIC_RELEASE);
+
+    const unsigned toSubmit = mQueuedTail - __atomic_load_n(mSubmissionHead, __ATOMIC_ACQUIRE);
+    if (toSubmit) {
+        enter(toSubmit, 0);
+    }
+}
+
+bool IoUringLoop::setup()
+{
+    io_uring_params params{};
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = CompletionEntries;
+
+    mFd = static_cast<int>(syscall(__NR_io_uring_setup, SubmissionEntries, &params));
+    if (mFd == -1) {
+        return false;
+    }
+
+    // Without NODROP, completions are lost when the ring overflows
+    if (!(params.features & IORING_FEAT_NODROP)) {
+        return false;
+    }
+
+    mSubmissionRingSize = params.sq_off.array + params.sq_entries * sizeof (unsigned);
+    mCompletionRingSize = params.cq_off.cqes + params.cq_entries * sizeof (io_uring_cqe);
+
+    const bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (singleMap) {
+        mSubmissionRingSize = qMax(mSubmissionRingSize, mCompletionRingSize);
+        mCompletionRingSize = mSubmissionRingSize;
+    }
+
+    mSubmissionRing = mmap(nullptr, mSubmissionRingSize, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE, mFd, IORING_OFF_SQ_RING);
+    if (mSubmissionRing == MAP_FAILED) {
+        return false;
+    }
+
+    if (singleMap) {
+        mCompletionRing = mSubmissionRing;
+    } else {
+        mCompletionRing = mmap(nullptr, mCompletionRingSize, PROT_READ | PROT_WRITE,
+                               MAP_SHARED | MAP_POPULATE, mFd, IORING_OFF_CQ_RING);
+        if (mCompletionRing == MAP_FAILED) {
+            return false;
+        }
+    }
+
+    mSubmissionEntries = static_cast<io_uring_sqe*>(
+        mmap(nullptr, params.sq_entries * sizeof (io_uring_sqe), PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, mFd, IORING_OFF_SQES));
+    if (mSubmissionEntries == MAP_FAILED) {
+        return false;
+    }
+
+    char *submissionRing = static_cast<char*>(mSubmissionRing);
+    mSubmissionHead = reinterpret_cast<unsigned*>(submissionRing + params.sq_off.head);
+    mSubmissionTail = reinterpret_cast<unsigned*>(submissionRing + params.sq_off.tail);
+    mSubmissionFlags = reinterpret_cast<unsigned*>(submissionRing + params.sq_off.flags);
+    mSubmissionArray = reinterpret_cast<unsigned*>(submissionRing + params.sq_off.array);
+    mSubmissionMask = *reinterpret_cast<unsigned*>(submissionRing + params.sq_off.ring_mask);
+    mSubmissionCount = params.sq_entries;
+    mQueuedTail = *mSubmissionTail;
+
+    char *completionRing = static_cast<char*>(mCompletionRing);
+    mCompletionHead = reinterpret_cast<unsigned*>(completionRing + params.cq_off.head);
+    mCompletionTail = reinterpret_cast<unsigned*>(completionRing + params.cq_off.tail);
+    mCompletionMask = *reinterpret_cast<unsigned*>(completionRing + params.cq_off.ring_mask);
+    mCompletionEntries = reinterpret_cast<io_uring_cqe*>(completionRing + params.cq_off.cqes);
+
+    // Entries are always filled in ring order, so the index array is fixed
+    for (unsigned i = 0; i < mSubmissionCount; ++i) {
+        mSubmissionArray[i] = i;
+    }
+
+    return true;
+}
+
+void IoUringLoop::teardown()
+{
+    if (mSubmissionEntries != MAP_FAILED) {
+        munmap(mSubmissionEntries, mSubmissionCount * sizeof (io_uring_sqe));
+        mSubmissionEntries = static_cast<io_uring_sqe*>(MAP_FAILED);
+    }
+    if (mCompletionRing != MAP_FAILED && mCompletionRing != mSubmissionRing) {
+        munmap(mCompletionRing, mCompletionRingSize);
+    }
+    mCompletionRing = MAP_FAILED;
+    if (mSubmissionRing != MAP_FAILED) {
+        munmap(mSubmissionRing, mSubmissionRingSize);
+        mSubmissionRing = MAP_FAILED;
+    }
+    if (mFd != -1) {
+        close(mFd);
+        mFd = -1;
+    }
+    if (mBuffers) {
+        munmap(mBuffers, static_cast<size_t>(mBufferCount) * BufferSize);
+        mBuffers = nullptr;
+        mBufferCount = 0;
+    }
+}
+
+void IoUringLoop::registerBuffers()
+{
+    // Registered memory counts against RLIMIT_MEMLOCK, so settle for fewer
+    // buffers when the full pool does not fit
+    for (int count = MaxBufferCount; count >= 64; count /= 2) {
+        const size_t size = static_cast<size_t>(count) * BufferSize;
+        void *buffers = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (buffers == MAP_FAILED) {
+            return;
+        }
+
+        QVector<iovec> iov(count);
+        for (int i = 0; i < count; ++i) {
+            iov[i].iov_base = static_cast<char*>(buffers) + i * BufferSize;
+            iov[i].iov_len = BufferSize;
+        }
+
+        if (syscall(__NR_io_uring_register, mFd, IORING_REGISTER_BUFFERS,
+                    iov.data(), count) == 0) {
+            mBuffers = static_cast<char*>(buffers);
+            mBufferCount = count;
+            for (int i = 0; i < count; ++i) {
+                mFreeBuffers.append(i);
+            }
+            return;
+        }
+
+        const int registerError = errno;
+        munmap(buffers, size);
+        if (registerError != ENOMEM) {
+            return;
+        }
+    }
+}
+
+IoUringLoop::Handle *IoUringLoop::createHandle(IoUringTransport *transport)
+{
+    Handle *handle = new Handle;
+    handle->transport = transport;
+    handle->fd = transport->socket();
+    handle->inflight = 0;
+    handle->operations = 0;
+
+    if (mFreeBuffers.isEmpty()) {
+        handle->buffer = -1;
+        handle->fallback.resize(BufferSize);
+        handle->data = handle->fallback.data();
+    } else {
+        handle->buffer = mFreeBuffers.takeLast();
+        handle->data = mBuffers + handle->buffer * BufferSize;
+    }
+
+    mHandles.insert(handle);
+    return handle;
+}
+
+void IoUringLoop::releaseHandle(Handle *handle)
+{
+    if (handle->buffer != -1) {
+        mFreeBuffers.append(handle->buffer);
+    }
+
+    mHandles.remove(handle);
+    delete handle;
+}
+
+io_uring_sqe *IoUringLoop::queue(Handle *handle, Operation operation)
+{
+    // Make room by submitting what is already queued
+    if (mQueuedTail - __atomic_load_n(mSubmissionHead, __ATOMIC_ACQUIRE) == mSubmissionCount) {
+        submit();
+        if (mQueuedTail - __atomic_load_n(mSubmissionHead, __ATOMIC_ACQUIRE) == mSubmissionCount) {
+            return nullptr;
+        }
+    }
+
+    io_uring_sqe *sqe = &mSubmissionEntries[mQueuedTail & mSubmissionMask];
+    memset(sqe, 0, sizeof (io_uring_sqe));
+    sqe->user_data = reinterpret_cast<quintptr>(handle) | operation;
+    ++mQueuedTail;
+
+    ++handle->inflight;
+    handle->operations |= operationBit(operation);
+
+    // Everything queued during this event loop iteration is submitted at once
+    if (!mSubmitScheduled) {
+        mSubmitScheduled = true;
+        QTimer::singleShot(0, this, &IoUringLoop::submit);
+    }
+
+    return sqe;
+}
+
+void IoUringLoop::cancel(Handle *handle)
+{
+    for (int operation = OperationRead; operation < OperationCancel; ++operation) {
+        if (handle->operations & operationBit(operation)) {
+            io_uring_sqe *sqe = queue(handle, OperationCancel);
+            if (sqe) {
+                sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                sqe->fd = -1;
+                sqe->addr = reinterpret_cast<quintptr>(handle) | operation;
+            }
+        }
+    }
+
+    // The descriptor is about to be closed and its number may be reused, so
+    // nothing that refers to it can be left unsubmitted
+    submit();
+}
+
+void IoUringLoop::complete(const io_uring_cqe &cqe)
+{
+    Handle *handle = reinterpret_cast<Handle*>(cqe.user_data & ~OperationMask);
+    const int operation = static_cast<int>(cqe.user_data & OperationMask);
+
+    --handle->inflight;
+    if (operation != OperationCancel) {
+        handle->operations &= ~operationBit(operation);
+        if (handle->transport) {
+            handle->transport->onCompletion(operation, cqe.res);
+        }
+    }
+
+    if (!handle->transport && !handle->inflight) {
+        releaseHandle(handle);
+    }
+}
+
+void IoUringLoop::enter(unsigned toSubmit, unsigned flags)
+{
+    // Entries that are not consumed (EBUSY, EAGAIN) stay queued for later
+    int ret;
+    do {
+        ++mSyscallCount;
+        ret = static_cast<int>(syscall(__NR_io_uring_enter, mFd, toSubmit, 0, flags, nullptr, 0));
+    } while (ret == -1 && errno == EINTR);
+}
+
+IoUringTransport::IoUringTransport(IoUringLoop *loop)
+    : mLoop(loop)
+    , mHandle(nullptr)
+    , mReceiving(false)
+{
+}
+
+IoUringTransport::~IoUringTransport()
+{
+    closeSocket();
+}
+
+bool IoUringTransport::attachSocket()
+{
+    mReceiving = false;
+    mHandle = mLoop->createHandle(this);
+    return true;
+}
+
+void IoUringTransport::detachSocket()
+{
+    if (mHandle) {
+        mHandle->transport = nullptr;
+        mLoop->cancel(mHandle);
+        if (!mHandle->inflight) {
+            mLoop->releaseHandle(mHandle);
+        }
+        mHandle = nullptr;
+    }
+
+    mReceiving = false;
+
+    // Operations still in flight hold their own reference to the socket
+    close(socket());
+}
+
+void IoUringTransport::watch(bool readable, bool writable)
+{
+    io_uring_sqe *sqe = mLoop->queue(mHandle, IoUringLoop::OperationWatch);
+    if (!sqe) {
+        onClosed(EBUSY);
+        return;
+    }
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = socket();
+    sqe->poll32_events = (readable ? POLLIN : 0) | (writable ? POLLOUT : 0);
+}
+
+void IoUringTransport::startReceiving()
+{
+    mReceiving = true;
+    receive();
+}
+
+void IoUringTransport::startSending()
+{
+    const int sendOperations =
+            operationBit(IoUringLoop::OperationSend) |
+            operationBit(IoUringLoop::OperationRetrySend);
+
+    if (!mHandle || (mHandle->operations & sendOperations) || !bytesToWrite()) {
+        return;
+    }
+
+    TraceSpan span("IoUringTransport::write");
+
+    io_uring_sqe *sqe = mLoop->queue(mHandle, IoUringLoop::OperationSend);
+    if (!sqe) {
+        onClosed(EBUSY);
+        return;
+    }
+
+    // The handle keeps the data alive until the kernel has sent it
+    mHandle->sending.clear();
+    mHandle->message = msghdr{};
+    mHandle->message.msg_iov = mHandle->iov;
+    mHandle->message.msg_iovlen = pendingIovecs(mHandle->iov, MaxIovecs, &mHandle->sending);
+
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = socket();
+    sqe->addr = reinterpret_cast<quintptr>(&mHandle->message);
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+}
+
+void IoUringTransport::receive()
+{
+    io_uring_sqe *sqe = mLoop->queue(mHandle, IoUringLoop::OperationRead);
+    if (!sqe) {
+        onClosed(EBUSY);
+        return;
+    }
+
+    sqe->fd = socket();
+    sqe->addr = reinterpret_cast<quintptr>(mHandle->data);
+    sqe->len = IoUringLoop::BufferSize;
+
+    if (mHandle->buffer == -1) {
+        sqe->opcode = IORING_OP_RECV;
+    } else {
+        sqe->opcode = IORING_OP_READ_FIXED;
+        sqe->buf_index = static_cast<quint16>(mHandle->buffer);
+    }
+}
+
+void IoUringTransport::onCompletion(int operation, int result)
+{
+    switch (operation) {
+    case IoUringLoop::OperationRead:
+        if (result > 0) {
+            onReceived(mHandle->data, result);
+            if (mReceiving) {
+                receive();
+            }
+        } else if (result == 0) {
+            onClosed(0);
+        } else if (result == -EAGAIN || result == -EINTR) {
+
+            // Non-blocking sockets may report EAGAIN instead of waiting
+            io_uring_sqe *sqe = mLoop->queue(mHandle, IoUringLoop::OperationRetryRead);
+            if (!sqe) {
+                onClosed(EBUSY);
+                return;
+            }
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->fd = socket();
+            sqe->poll32_events = POLLIN;
+        } else {
+            onClosed(-result);
+        }
+        break;
+
+    case IoUringLoop::OperationRetryRead:
+        if (mReceiving) {
+            receive();
+        }
+        break;
+
+    case IoUringLoop::OperationSend:
+        mHandle->sending.clear();
+        if (result >= 0) {
+            onSent(result);
+            startSending();
+        } else if (result == -EAGAIN || result == -EINTR) {
+            io_uring_sqe *sqe = mLoop->queue(mHandle, IoUringLoop::OperationRetrySend);
+            if (!sqe) {
+                onClosed(EBUSY);
+                return;
+            }
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->fd = socket();
+            sqe->poll32_events = POLLOUT;
+        } else {
+            onClosed(-result);
+        }
+        break;
+
+    case IoUringLoop::OperationRetrySend:
+        startSending();
+        break;
+
+    case IoUringLoop::OperationWatch:
+        if (result < 0) {
+            onClosed(-result);
+        } else {
+            onReady(result & POLLIN, result & (POLLOUT | POLLERR | POLLHUP));
+        }
+        break;
+    }
+}
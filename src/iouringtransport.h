@@ -0,0 +1,173 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Nathan Osman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef IOURINGTRANSPORT_H
+#define IOURINGTRANSPORT_H
+
+#include <QObject>
+#include <QSet>
+
+#include "sockettransport.h"
+
+struct io_uring_cqe;
+struct io_uring_sqe;
+
+class QSocketNotifier;
+
+class IoUringTransport;
+
+/**
+ * @brief Per-thread io_uring instance driving any number of IoUringTransports
+ *
+ * Operations queued while handling events are submitted together with a
+ * single io_uring_enter() call once control returns to the event loop. The
+ * ring descriptor is watched by a QSocketNotifier, so completions are reaped
+ * from the thread's Qt event loop.
+ *
+ * A pool of fixed-size receive buffers is registered with the kernel up
+ * front so that reads avoid mapping user pages on every completion. Sockets
+ * that do not get a registered buffer fall back to an ordinary one.
+ */
+class IoUringLoop : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    static IoUringLoop *instance();
+
+    IoUringLoop();
+    virtual ~IoUringLoop();
+
+    inline bool isValid() const { return mFd != -1; }
+    inline int fd() const { return mFd; }
+
+    inline int registeredBufferCount() const { return mBufferCount; }
+    inline quint64 syscallCount() const { return mSyscallCount; }
+
+    void processEvents();
+    void submit();
+
+private:
+
+    friend class IoUringTransport;
+
+    struct Handle;
+
+    enum Operation {
+        OperationRead = 1,
+        OperationSend,
+        OperationWatch,
+        OperationRetryRead,
+        OperationRetrySend,
+        OperationCancel
+    };
+
+    static const unsigned SubmissionEntries = 4096;
+    static const unsigned CompletionEntries = 8192;
+    static const int BufferSize = 4096;
+    static const int MaxBufferCount = 1024;
+
+    bool setup();
+    void teardown();
+    void registerBuffers();
+
+    Handle *createHandle(IoUringTransport *transport);
+    void releaseHandle(Handle *handle);
+
+    io_uring_sqe *queue(Handle *handle, Operation operation);
+    void cancel(Handle *handle);
+    void complete(const io_uring_cqe &cqe);
+    void enter(unsigned toSubmit, unsigned flags);
+
+    int mFd;
+    QSocketNotifier *mNotifier;
+
+    void *mSubmissionRing;
+    size_t mSubmissionRingSize;
+    void *mCompletionRing;
+    size_t mCompletionRingSize;
+    io_uring_sqe *mSubmissionEntries;
+
+    unsigned *mSubmissionHead;
+    unsigned *mSubmissionTail;
+    unsigned *mSubmissionFlags;
+    unsigned *mSubmissionArray;
+    unsigned mSubmissionMask;
+    unsigned mSubmissionCount;
+    unsigned mQueuedTail;
+
+    unsigned *mCompletionHead;
+    unsigned *mCompletionTail;
+    unsigned mCompletionMask;
+    io_uring_cqe *mCompletionEntries;
+
+    bool mSubmitScheduled;
+
+    char *mBuffers;
+    int mBufferCount;
+    QList<int> mFreeBuffers;
+
+    QSet<Handle*> mHandles;
+
+    quint64 mSyscallCount;
+};
+
+/**
+ * @brief Transport for a socket using io_uring
+ *
+ * Each socket keeps one receive and at most one send in flight. Sends are
+ * issued with sendmsg() directly from the pending queue. The buffers being
+ * sent are retained by the ring until the kernel is done with them, even if
+ * the transport is destroyed first.
+ */
+class IoUringTransport : public SocketTransport
+{
+public:
+
+    explicit IoUringTransport(IoUringLoop *loop);
+    virtual ~IoUringTransport();
+
+protected:
+
+    virtual bool attachSocket();
+    virtual void detachSocket();
+    virtual void watch(bool readable, bool writable);
+    virtual void startReceiving();
+    virtual void startSending();
+
+private:
+
+    friend class IoUringLoop;
+
+    void receive();
+    void onCompletion(int operation, int result);
+
+    IoUringLoop *mLoop;
+    IoUringLoop::Handle *mHandle;
+
+    bool mReceiving;
+};
+
+#endif // IOURINGTRANSPORT_H
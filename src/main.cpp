@@ -25,6 +25,7 @@
 #include <QApplication>
 
 #include "mainwindow.h"
+#include "trace.h"
 
 int main(int argc, char **argv)
 {
@@ -34,8 +35,23 @@ int main(int argc, char **argv)
 
     QApplication app(argc, argv);
 
+    // Tracing is enabled by naming the file to dump spans to; a dump can
+    // also be requested at any time with SIGUSR1
+    const QString traceFileName = QString::fromLocal8Bit(qgetenv("AUDIO_STREAMER_TRACE"));
+    if (!traceFileName.isEmpty()) {
+        Trace::setEnabled(true);
+        Trace::setThreadName("GUI");
+        Trace::dumpOnSignal(traceFileName);
+    }
+
     MainWindow mainWindow;
     mainWindow.show();
 
-    return app.exec();
+    int ret = app.exec();
+
+    if (Trace::isEnabled()) {
+        Trace::dump(traceFileName);
+    }
+
+    return ret;
 }
@@ -31,6 +31,7 @@
 #include <QUrl>
 
 #include "mainwindow.h"
+#include "trace.h"
 
 const QString SettingDeviceName("deviceName");
 const QString SettingGeometry("geometry");
@@ -43,6 +44,7 @@ MainWindow::MainWindow()
     , mHostNameEdit(new QLineEdit)
     , mConnectionButton(new QPushButton)
     , mLogEdit(new QTextEdit)
+    , mEncodeStreamId(mEncodePool.addStream())
 {
     mHostNameEdit->setPlaceholderText(tr("RTMP server URL"));
     mHostNameEdit->setText(mSettings.value(SettingHostName).toString());
@@ -57,6 +59,14 @@ MainWindow::MainWindow()
     connect(&mRecorder, &Recorder::log, this, &MainWindow::onLog);
     connect(&mClient, &Client::log, this, &MainWindow::onLog);
 
+    // Captured audio is PCM, which the pool tags inline on the GUI thread
+    connect(&mRecorder, &Recorder::audioData, this, [this](const QByteArray &data) {
+        mEncodePool.submit(mEncodeStreamId, data);
+    });
+    connect(&mEncodePool, &EncodePool::encoded, &mClient, [this](int, const QByteArray &data, quint32 timestamp, quint64 blockId) {
+        mClient.sendAudio(data, timestamp, blockId);
+    });
+
     QGridLayout *gridLayout = new QGridLayout;
     gridLayout->addWidget(mDeviceComboBox, 0, 0);
     gridLayout->addWidget(mRefreshButton, 0, 1);
@@ -135,8 +145,7 @@ void MainWindow::onConnectClicked()
     if (mClient.isActive()) {
         mClient.stop();
     } else {
-        QUrl url(mHostNameEdit->text());
-        mClient.start(url.host());
+        mClient.start(QUrl(mHostNameEdit->text()));
     }
 
     toggleConnected(mClient.isActive());
@@ -144,6 +153,8 @@ void MainWindow::onConnectClicked()
 
 void MainWindow::onLog(LogType logType, const QString &message)
 {
+    TraceSpan span("MainWindow::onLog");
+
     QString formatColor;
 
     switch (logType) {
@@ -33,6 +33,7 @@
 #include <QTextEdit>
 
 #include "client.h"
+#include "encodepool.h"
 #include "log.h"
 #include "recorder.h"
 
@@ -70,6 +71,9 @@ private:
 
     Recorder mRecorder;
     Client mClient;
+
+    EncodePool mEncodePool;
+    int mEncodeStreamId;
 };
 
 #endif // MAINWINDOW_H
@@ -22,15 +22,48 @@
  * IN THE SOFTWARE.
  */
 
+#include <cstddef>
 #include <cstring>
 
 #include <QDateTime>
+#include <QVariantMap>
 #include <QtEndian>
 
+#include "amf.h"
 #include "protocol.h"
+#include "trace.h"
 
 const quint8 Version = 0x03;
 
+const quint32 CommandChunkStreamId = 3;
+const quint32 AudioChunkStreamId = 4;
+
+const quint8 MessageSetChunkSize = 1;
+const quint8 MessageAbort = 2;
+const quint8 MessageAcknowledgement = 3;
+const quint8 MessageUserControl = 4;
+const quint8 MessageWindowAckSize = 5;
+const quint8 MessageSetPeerBandwidth = 6;
+const quint8 MessageAudio = 8;
+const quint8 MessageCommand = 20;
+
+const quint16 EventPingRequest = 6;
+const quint16 EventPingResponse = 7;
+
+const int DefaultChunkSize = 128;
+const quint32 ExtendedTimestamp = 0xffffff;
+
+// Large enough for a block of audio to fit in a single chunk
+const quint32 OutChunkSize = 4096;
+
+const int ConnectTransaction = 1;
+const int CreateStreamTransaction = 2;
+
+// Chunks are only handed to the transport while less than this amount is
+// waiting to be written, so that control messages are never stuck behind a
+// large backlog of audio
+const qint64 WriteWatermark = 8192;
+
 struct Handshake2
 {
     quint32 time;
@@ -45,26 +78,45 @@ struct Handshake3
     quint8 random[1528];
 };
 
-struct Chunk
-{
-    //...
-};
-
 inline quint32 currentTimestamp()
 {
     return static_cast<quint32>(QDateTime::currentMSecsSinceEpoch());
 }
 
-Protocol::Protocol(QIODevice *device, QObject *parent)
+inline quint32 readUInt24(const uchar *data)
+{
+    return (data[0] << 16) | (data[1] << 8) | data[2];
+}
+
+inline quint32 readUInt32(const QByteArray &data, int offset = 0)
+{
+    return qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(data.constData() + offset));
+}
+
+inline QByteArray uint32Payload(quint32 value)
+{
+    value = qToBigEndian<quint32>(value);
+    return QByteArray(reinterpret_cast<const char*>(&value), sizeof (value));
+}
+
+Protocol::Protocol(Transport *transport, QObject *parent)
     : QObject(parent)
-    , mDevice(device)
-    , mState(StateNone)
+    , mTransport(transport)
 {
-    connect(mDevice, &QIODevice::readyRead, this, &Protocol::onReadyRead);
+    mTransport->setReadCallback([this](const char *data, qint64 size) {
+        onDataReceived(data, size);
+    });
+    mTransport->setWrittenCallback([this]() {
+        onWritten();
+    });
+
+    reset();
 }
 
 void Protocol::startHandshake()
 {
+    reset();
+
     mEpoch = currentTimestamp();
 
     // Send the C0 and C1 packets
@@ -74,41 +126,173 @@ void Protocol::startHandshake()
         {0}
     };
 
-    mDevice->write(reinterpret_cast<const char*> (&Version), sizeof (quint8));
-    mDevice->write(reinterpret_cast<const char*> (&handshake2), sizeof (Handshake2));
+    QByteArray packet;
+    packet.reserve(sizeof (quint8) + sizeof (Handshake2));
+    packet.append(reinterpret_cast<const char*> (&Version), sizeof (quint8));
+    packet.append(reinterpret_cast<const char*> (&handshake2), sizeof (Handshake2));
+
+    mTransport->write(packet);
+    mTransport->flush();
     mState = StateVersionSent;
 }
 
-void Protocol::onReadyRead()
+void Protocol::publish(const QString &app, const QString &tcUrl, const QString &streamKey)
+{
+    mStreamKey = streamKey;
+
+    // The stream is created and published once the server accepts this
+    sendCommand(0, {
+        "connect",
+        ConnectTransaction,
+        QVariantMap{
+            {"app", app},
+            {"type", "nonprivate"},
+            {"flashVer", "FMLE/3.0 (compatible; audio-streamer)"},
+            {"tcUrl", tcUrl}
+        }
+    });
+}
+
+void Protocol::sendAudio(const QByteArray &data, quint32 timestamp, quint64 blockId)
+{
+    if (!mPublishing) {
+        return;
+    }
+
+    mScheduler.enqueue(AudioChunkStreamId, MessageAudio, timestamp, mStreamId, data, blockId);
+    pump();
+}
+
+void Protocol::deleteStream()
+{
+    if (!mStreamId) {
+        return;
+    }
+
+    // Audio that has not started sending yet would only delay the command
+    mScheduler.discardPending(AudioChunkStreamId);
+
+    sendCommand(0, {"deleteStream", 0, QVariant(), mStreamId});
+
+    mStreamId = 0;
+    mPublishing = false;
+
+    // The connection is about to close, so write out everything that is left
+    pump(true);
+}
+
+void Protocol::reset()
+{
+    mState = StateNone;
+    mReadBuffer.clear();
+    mReadRequired = 0;
+
+    mChunkStreams.clear();
+    mInChunkSize = DefaultChunkSize;
+
+    mWindowAckSize = 0;
+    mPeerBandwidth = 0;
+    mBytesReceived = 0;
+    mBytesAcknowledged = 0;
+
+    mScheduler.clear();
+
+    mStreamKey.clear();
+    mStreamId = 0;
+    mPublishing = false;
+}
+
+void Protocol::onDataReceived(const char *data, qint64 size)
+{
+    TraceSpan span("Protocol::dataReceived");
+
+    // Nothing more is parsed after a failure, until the next handshake
+    if (mState == StateNone) {
+        return;
+    }
+
+    mBytesReceived += size;
+
+    // A unit that was split across reads is completed first, copying only
+    // as many bytes as it is known to still need
+    while (!mReadBuffer.isEmpty()) {
+        const qint64 count = qMin(mReadRequired - mReadBuffer.size(), size);
+        mReadBuffer.append(data, static_cast<int>(count));
+        data += count;
+        size -= count;
+
+        if (mReadBuffer.size() < mReadRequired) {
+            return;
+        }
+
+        const qint64 consumed = process(mReadBuffer.constData(), mReadBuffer.size(), mReadRequired);
+        mReadBuffer.remove(0, static_cast<int>(consumed));
+        if (mState == StateNone) {
+            return;
+        }
+    }
+
+    // Everything else is parsed in place from the transport's buffer
+    while (size) {
+        const qint64 consumed = process(data, size, mReadRequired);
+        if (!consumed) {
+            break;
+        }
+        data += consumed;
+        size -= consumed;
+        if (mState == StateNone) {
+            return;
+        }
+    }
+
+    // Keep the incomplete tail for the next read
+    mReadBuffer.append(data, static_cast<int>(size));
+}
+
+void Protocol::onWritten()
 {
-    mReadBuffer.append(mDevice->readAll());
+    pump();
+}
 
+qint64 Protocol::process(const char *data, qint64 size, qint64 &required)
+{
     switch (mState) {
-    case StateNone:
-        break;
     case StateVersionSent:
-        if (static_cast<size_t> (mReadBuffer.size()) >= sizeof (quint8) + sizeof (Handshake2)) {
-            processVersion();
+        required = sizeof (quint8) + sizeof (Handshake2);
+        if (size < required) {
+            return 0;
         }
-        break;
+        processVersion(data);
+        return required;
     case StateAckSent:
-        if (static_cast<size_t> (mReadBuffer.size()) >= sizeof (Handshake2)) {
-            processAck();
+        required = sizeof (Handshake2);
+        if (size < required) {
+            return 0;
         }
-        break;
+        processAck();
+        return required;
+    case StateConnected:
+        if (mWindowAckSize && mBytesReceived - mBytesAcknowledged >= mWindowAckSize) {
+            mBytesAcknowledged = mBytesReceived;
+            sendControl(MessageAcknowledgement, uint32Payload(static_cast<quint32>(mBytesReceived)));
+        }
+        return processChunk(reinterpret_cast<const uchar*>(data), size, required);
+    default:
+        required = size + 1;
+        return 0;
     }
 }
 
-void Protocol::processVersion()
+void Protocol::processVersion(const char *data)
 {
     // Read the S0 and S1 packets
-    const quint8 serverVersion = *reinterpret_cast<const quint8*> (mReadBuffer.constData());
-    const Handshake2 *handshake2 = reinterpret_cast<const Handshake2*> (mReadBuffer.constData() + 1);
-    mReadBuffer.remove(0, sizeof(quint8) + sizeof (Handshake2));
+    // S1 directly follows the version byte, so it is not aligned
+    const quint8 serverVersion = *reinterpret_cast<const quint8*> (data);
+    const char *handshake2 = data + sizeof (quint8);
 
     // Confirm that version 3+ is supported
     if (serverVersion < Version) {
-        emit error(tr("invalid version %1 specified").arg(serverVersion));
+        fail(tr("invalid version %1 specified").arg(serverVersion));
         return;
     }
 
@@ -118,19 +302,251 @@ void Protocol::processVersion()
         qToBigEndian<quint32>(currentTimestamp()),
         {0}
     };
-    memcpy(clientHandshake2.random, handshake2->random, sizeof (Handshake2::random));
+    memcpy(clientHandshake2.random, handshake2 + offsetof(Handshake2, random), sizeof (Handshake2::random));
 
-    mDevice->write(reinterpret_cast<const char*> (&clientHandshake2), sizeof (Handshake2));
+    mTransport->write(QByteArray(reinterpret_cast<const char*> (&clientHandshake2), sizeof (Handshake2)));
+    mTransport->flush();
     mState = StateAckSent;
 }
 
 void Protocol::processAck()
 {
-    // Nothing is done with the ACK, so discard it
-    mReadBuffer.remove(0, sizeof (Handshake2));
+    // Nothing is done with the ACK, so it is simply skipped
+    mState = StateConnected;
+
+    // The scheduler switches to the new size once this has been sent
+    sendControl(MessageSetChunkSize, uint32Payload(OutChunkSize));
 
     emit handshakeCompleted();
+}
+
+qint64 Protocol::processChunk(const uchar *data, qint64 size, qint64 &required)
+{
+    // Basic header: format and chunk stream ID
+    required = 1;
+    if (size < required) {
+        return 0;
+    }
+
+    const quint8 format = data[0] >> 6;
+    quint32 chunkStreamId = data[0] & 0x3f;
+    int offset = 1;
+    if (chunkStreamId == 0) {
+        required = 2;
+        if (size < required) {
+            return 0;
+        }
+        chunkStreamId = 64 + data[1];
+        offset = 2;
+    } else if (chunkStreamId == 1) {
+        required = 3;
+        if (size < required) {
+            return 0;
+        }
+        chunkStreamId = 64 + data[1] + (data[2] << 8);
+        offset = 3;
+    }
+
+    // Message header, which omits more fields for each higher format
+    static const int headerSizes[] = {11, 7, 3, 0};
+    required = offset + headerSizes[format];
+    if (size < required) {
+        return 0;
+    }
+
+    const ChunkStream &previous = mChunkStreams.value(chunkStreamId);
+    quint32 length = previous.length;
+    quint8 typeId = previous.typeId;
+    bool extended = previous.extended;
+
+    if (format <= 2) {
+        extended = readUInt24(data + offset) == ExtendedTimestamp;
+    }
+    if (format <= 1) {
+        length = readUInt24(data + offset + 3);
+        typeId = data[offset + 6];
+    }
+    offset += headerSizes[format];
+    if (extended) {
+        offset += 4;
+    }
+
+    const int payloadSize = qMin<qint64>(mInChunkSize, length - previous.payload.size());
+    required = offset + payloadSize;
+    if (size < required) {
+        return 0;
+    }
+
+    // The chunk is complete, so it can be applied to the chunk stream
+    ChunkStream &chunkStream = mChunkStreams[chunkStreamId];
+    chunkStream.length = length;
+    chunkStream.typeId = typeId;
+    chunkStream.extended = extended;
+
+    const char *payloadData = reinterpret_cast<const char*>(data + offset);
+
+    // A message carried by a single chunk is handed over without a copy,
+    // since nothing holds on to the payload after it has been processed
+    if (chunkStream.payload.isEmpty() && static_cast<quint32>(payloadSize) >= length) {
+        processMessage(typeId, QByteArray::fromRawData(payloadData, payloadSize));
+        return required;
+    }
+
+    chunkStream.payload.append(payloadData, payloadSize);
+
+    if (static_cast<quint32>(chunkStream.payload.size()) >= chunkStream.length) {
+        QByteArray payload;
+        payload.swap(chunkStream.payload);
+        processMessage(typeId, payload);
+    }
+
+    return required;
+}
+
+void Protocol::processMessage(quint8 typeId, const QByteArray &payload)
+{
+    const bool hasValue = payload.size() >= 4;
+
+    switch (typeId) {
+    case MessageSetChunkSize:
+        if (hasValue) {
+            mInChunkSize = static_cast<int>(readUInt32(payload) & 0x7fffffff);
+            if (!mInChunkSize) {
+                fail(tr("invalid chunk size"));
+            }
+        }
+        break;
+    case MessageAbort:
+        if (hasValue) {
+            mChunkStreams[readUInt32(payload)].payload.clear();
+        }
+        break;
+    case MessageUserControl:
+        processUserControl(payload);
+        break;
+    case MessageWindowAckSize:
+        if (hasValue) {
+            mWindowAckSize = readUInt32(payload);
+        }
+        break;
+    case MessageSetPeerBandwidth:
+        if (hasValue && readUInt32(payload) != mPeerBandwidth) {
+            mPeerBandwidth = readUInt32(payload);
+            sendControl(MessageWindowAckSize, uint32Payload(mPeerBandwidth));
+        }
+        break;
+    case MessageCommand:
+        processCommand(payload);
+        break;
+    }
+}
+
+void Protocol::processUserControl(const QByteArray &payload)
+{
+    if (payload.size() < 6) {
+        return;
+    }
+
+    const quint16 eventType = qFromBigEndian<quint16>(reinterpret_cast<const uchar*>(payload.constData()));
+
+    // Unanswered pings cause servers to drop the connection
+    if (eventType == EventPingRequest) {
+        QByteArray response;
+        const quint16 responseType = qToBigEndian<quint16>(EventPingResponse);
+        response.append(reinterpret_cast<const char*>(&responseType), sizeof (responseType));
+        response.append(payload.mid(2, 4));
+        sendControl(MessageUserControl, response);
+    }
+}
+
+void Protocol::processCommand(const QByteArray &payload)
+{
+    // Only the values needed to act on a command are decoded, so that
+    // anything else the server includes cannot fail the connection
+    QVariantList values;
+    if (!Amf::decode(payload, values, 2) || values.size() < 2) {
+        return;
+    }
+
+    const QString name = values.at(0).toString();
+    const int transactionId = static_cast<int>(values.at(1).toDouble());
+
+    // Commands that answer neither connect nor createStream are not awaited
+    const bool awaited = transactionId == ConnectTransaction ||
+            transactionId == CreateStreamTransaction;
+
+    if (name == "_result" && transactionId == ConnectTransaction) {
+        sendCommand(0, {"createStream", CreateStreamTransaction, QVariant()});
+    } else if (name == "_result" && transactionId == CreateStreamTransaction) {
+        values.clear();
+        if (!Amf::decode(payload, values, 4) || values.size() < 4) {
+            fail(tr("malformed createStream response received"));
+            return;
+        }
+        mStreamId = static_cast<quint32>(values.at(3).toDouble());
+        sendCommand(mStreamId, {"publish", 0, QVariant(), mStreamKey, "live"});
+    } else if (name == "_error" && awaited) {
+        values.clear();
+        Amf::decode(payload, values, 4);
+        const QString description = values.value(3).toMap().value("description").toString();
+        fail(description.isEmpty() ? tr("command rejected by server") : description);
+    } else if (name == "onStatus") {
+        // A status that cannot be read only matters while publish is awaited
+        values.clear();
+        if (!Amf::decode(payload, values, 4) || values.size() < 4) {
+            if (!mPublishing) {
+                fail(tr("malformed status received"));
+            }
+            return;
+        }
+        const QVariantMap info = values.at(3).toMap();
+        const QString code = info.value("code").toString();
+        if (code == "NetStream.Publish.Start") {
+            mPublishing = true;
+            emit publishStarted();
+        } else if (info.value("level").toString() == "error") {
+            fail(code);
+        }
+    }
+}
+
+void Protocol::sendControl(quint8 typeId, const QByteArray &payload)
+{
+    mScheduler.enqueue(ChunkScheduler::ControlChunkStreamId, typeId, 0, 0, payload);
+    pump();
+}
 
-    // TODO: update the state
+void Protocol::sendCommand(quint32 streamId, const QVariantList &values)
+{
+    mScheduler.enqueue(CommandChunkStreamId, MessageCommand, 0, streamId, Amf::encode(values));
+    pump();
 }
 
+void Protocol::pump(bool all)
+{
+    if (mState != StateConnected) {
+        return;
+    }
+
+    TraceSpan span("Protocol::pump");
+
+    // Gather chunks into a single write while there is room below the mark
+    QByteArray batch;
+    while (all || mTransport->bytesToWrite() + batch.size() < WriteWatermark) {
+        if (!mScheduler.nextChunk(batch)) {
+            break;
+        }
+    }
+
+    if (!batch.isEmpty()) {
+        mTransport->write(batch);
+        mTransport->flush();
+    }
+}
+
+void Protocol::fail(const QString &errorMessage)
+{
+    mState = StateNone;
+    mReadBuffer.clear();
+    emit error(errorMessage);
+}
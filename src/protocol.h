@@ -25,7 +25,13 @@
 #ifndef PROTOCOL_H
 #define PROTOCOL_H
 
-#include <QIODevice>
+#include <QByteArray>
+#include <QHash>
+#include <QObject>
+#include <QVariantList>
+
+#include "chunkscheduler.h"
+#include "transport.h"
 
 /**
  * @brief Implementation of the RTMP protocol for streaming audio
@@ -36,35 +42,78 @@ class Protocol : public QObject
 
 public:
 
-    Protocol(QIODevice *device, QObject *parent = nullptr);
+    Protocol(Transport *transport, QObject *parent = nullptr);
 
     void startHandshake();
 
+    void publish(const QString &app, const QString &tcUrl, const QString &streamKey);
+    void sendAudio(const QByteArray &data, quint32 timestamp, quint64 blockId = 0);
+    void deleteStream();
+
+    inline bool isPublishing() const { return mPublishing; }
+
 signals:
 
     void error(const QString &errorMessage);
     void handshakeCompleted();
+    void publishStarted();
 
-private slots:
+private:
 
-    void onReadyRead();
+    void reset();
 
-private:
+    void onDataReceived(const char *data, qint64 size);
+    void onWritten();
 
-    void processVersion();
+    qint64 process(const char *data, qint64 size, qint64 &required);
+    void processVersion(const char *data);
     void processAck();
+    qint64 processChunk(const uchar *data, qint64 size, qint64 &required);
+    void processMessage(quint8 typeId, const QByteArray &payload);
+    void processUserControl(const QByteArray &payload);
+    void processCommand(const QByteArray &payload);
+
+    void sendControl(quint8 typeId, const QByteArray &payload);
+    void sendCommand(quint32 streamId, const QVariantList &values);
+    void pump(bool all = false);
 
-    QIODevice *mDevice;
+    void fail(const QString &errorMessage);
+
+    Transport *mTransport;
 
     enum {
         StateNone = 0,
         StateVersionSent,
-        StateAckSent
+        StateAckSent,
+        StateConnected
     } mState;
 
     quint32 mEpoch;
 
     QByteArray mReadBuffer;
+    qint64 mReadRequired;
+
+    struct ChunkStream
+    {
+        quint32 length = 0;
+        quint8 typeId = 0;
+        bool extended = false;
+        QByteArray payload;
+    };
+
+    QHash<quint32, ChunkStream> mChunkStreams;
+    int mInChunkSize;
+
+    quint32 mWindowAckSize;
+    quint32 mPeerBandwidth;
+    quint64 mBytesReceived;
+    quint64 mBytesAcknowledged;
+
+    ChunkScheduler mScheduler;
+
+    QString mStreamKey;
+    quint32 mStreamId;
+    bool mPublishing;
 };
 
 #endif // PROTOCOL_H
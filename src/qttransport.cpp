@@ -0,0 +1,170 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Nathan Osman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <QHash>
+#include <QMutex>
+#include <QSslConfiguration>
+
+#include "qttransport.h"
+#include "trace.h"
+
+#ifdef Q_OS_LINUX
+#  include <netinet/in.h>
+#  include <netinet/tcp.h>
+#  include <sys/socket.h>
+#endif
+
+// Session tickets are shared by every transport and keyed by host name
+static QMutex sessionTicketMutex;
+static QHash<QString, QByteArray> sessionTickets;
+
+QtTransport::QtTransport(QObject *parent)
+    : QObject(parent)
+    , mSecure(false)
+{
+    connect(&mSocket, &QSslSocket::connected, this, &QtTransport::onConnected);
+    connect(&mSocket, &QSslSocket::encrypted, this, &QtTransport::onEncrypted);
+    connect(&mSocket, &QSslSocket::readyRead, this, &QtTransport::onReadyRead);
+    connect(&mSocket, &QSslSocket::bytesWritten, this, &QtTransport::onBytesWritten);
+    connect(&mSocket, &QSslSocket::encryptedBytesWritten, this, &QtTransport::onBytesWritten);
+    connect(&mSocket, qOverload<QAbstractSocket::SocketError>(&QSslSocket::error),
+            this, &QtTransport::onError);
+
+    // With TLS 1.3, tickets arrive after the handshake has completed
+#if QT_VERSION >= QT_VERSION_CHECK(5, 15, 0)
+    connect(&mSocket, &QSslSocket::newSessionTicketReceived, this, &QtTransport::onSessionTicket);
+#endif
+    connect(&mSocket, &QSslSocket::disconnected, this, &QtTransport::onSessionTicket);
+}
+
+void QtTransport::connectToHost(const QString &hostName, quint16 port, bool secure)
+{
+    mSecure = secure;
+    mHostName = hostName;
+
+    if (mSecure) {
+
+        QByteArray sessionTicket;
+        {
+            QMutexLocker locker(&sessionTicketMutex);
+            sessionTicket = sessionTickets.value(hostName);
+        }
+
+        // Offer the ticket from the previous session with this host (if any)
+        // so that reconnecting can skip the full TLS handshake
+        QSslConfiguration sslConfiguration = mSocket.sslConfiguration();
+        sslConfiguration.setSslOption(QSsl::SslOptionDisableSessionTickets, false);
+        sslConfiguration.setSslOption(QSsl::SslOptionDisableSessionPersistence, false);
+        sslConfiguration.setSessionTicket(sessionTicket);
+        sslConfiguration.setPeerVerifyMode(verifyPeer() ? QSslSocket::AutoVerifyPeer : QSslSocket::VerifyNone);
+        mSocket.setSslConfiguration(sslConfiguration);
+
+        mSocket.connectToHostEncrypted(hostName, port);
+    } else {
+        mSocket.connectToHost(hostName, port);
+    }
+}
+
+void QtTransport::disconnectFromHost()
+{
+    // The socket finishes writing pending data before it disconnects
+    mSocket.disconnectFromHost();
+}
+
+void QtTransport::write(const QByteArray &data)
+{
+    TraceSpan span("QtTransport::write");
+    mSocket.write(data);
+}
+
+void QtTransport::flush()
+{
+    // The socket buffers writes and sends them from the event loop
+}
+
+qint64 QtTransport::bytesToWrite() const
+{
+    // For TLS, plaintext is encrypted as soon as it is written, so most of
+    // the backlog sits in the encrypted buffer instead
+    return mSocket.bytesToWrite() + mSocket.encryptedBytesToWrite();
+}
+
+void QtTransport::onConnected()
+{
+    log(LogType::Success, "connected to host");
+
+#ifdef Q_OS_LINUX
+    // Data the kernel has not sent yet can no longer be overtaken by control
+    // messages, so the socket only accepts a little more than is in flight
+    const int lowWatermark = 16384;
+    setsockopt(static_cast<int>(mSocket.socketDescriptor()), IPPROTO_TCP, TCP_NOTSENT_LOWAT,
+               &lowWatermark, sizeof (lowWatermark));
+#endif
+
+    // For RTMPS, the RTMP handshake must wait until TLS is established
+    if (mSecure) {
+        log(LogType::Info, "negotiating TLS...");
+        return;
+    }
+
+    connected();
+}
+
+void QtTransport::onEncrypted()
+{
+    log(LogType::Success, QString("TLS session established (%1)")
+        .arg(mSocket.sessionCipher().name()));
+
+    onSessionTicket();
+    connected();
+}
+
+void QtTransport::onReadyRead()
+{
+    const QByteArray data = mSocket.readAll();
+    received(data.constData(), data.size());
+}
+
+void QtTransport::onBytesWritten()
+{
+    written();
+}
+
+void QtTransport::onError()
+{
+    failed(mSocket.errorString());
+}
+
+void QtTransport::onSessionTicket()
+{
+    if (!mSecure) {
+        return;
+    }
+
+    const QByteArray sessionTicket = mSocket.sslConfiguration().sessionTicket();
+    if (!sessionTicket.isEmpty()) {
+        QMutexLocker locker(&sessionTicketMutex);
+        sessionTickets.insert(mHostName, sessionTicket);
+    }
+}
@@ -0,0 +1,69 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Nathan Osman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef QTTRANSPORT_H
+#define QTTRANSPORT_H
+
+#include <QByteArray>
+#include <QSslSocket>
+
+#include "transport.h"
+
+/**
+ * @brief Transport backed by QSslSocket, used by the GUI
+ */
+class QtTransport : public QObject, public Transport
+{
+    Q_OBJECT
+
+public:
+
+    explicit QtTransport(QObject *parent = nullptr);
+
+    virtual void connectToHost(const QString &hostName, quint16 port, bool secure);
+    virtual void disconnectFromHost();
+
+    virtual void write(const QByteArray &data);
+    virtual void flush();
+
+    virtual qint64 bytesToWrite() const;
+
+private slots:
+
+    void onConnected();
+    void onEncrypted();
+    void onReadyRead();
+    void onBytesWritten();
+    void onError();
+    void onSessionTicket();
+
+private:
+
+    QSslSocket mSocket;
+    bool mSecure;
+
+    QString mHostName;
+};
+
+#endif // QTTRANSPORT_H
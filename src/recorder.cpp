@@ -22,12 +22,11 @@
  * IN THE SOFTWARE.
  */
 
-#include <QAudioFormat>
-
 #include "recorder.h"
+#include "trace.h"
 
 Recorder::Recorder(QObject *parent)
-    : QObject(parent)
+    : AudioSource(parent)
     , mAudioInput(nullptr)
 {
 }
@@ -45,18 +44,11 @@ void Recorder::setDevice(const QAudioDeviceInfo &audioDeviceInfo)
         mAudioInput->deleteLater();
     }
 
-    QAudioFormat audioFormat;
-    audioFormat.setByteOrder(QAudioFormat::LittleEndian);
-    audioFormat.setChannelCount(1);
-    audioFormat.setCodec("audio/pcm");
-    audioFormat.setSampleRate(44100);
-    audioFormat.setSampleSize(16);
-    audioFormat.setSampleType(QAudioFormat::SignedInt);
-
-    mAudioInput = new QAudioInput(audioDeviceInfo, audioFormat, this);
+    mAudioInput = new QAudioInput(audioDeviceInfo, audioFormat(), this);
 
     QIODevice *device = mAudioInput->start();
     connect(device, &QIODevice::readyRead, [this, device]() {
+        TraceSpan span("Recorder::audioData");
         emit audioData(device->readAll());
     });
 }
@@ -28,12 +28,12 @@
 #include <QAudioDeviceInfo>
 #include <QAudioInput>
 
-#include "log.h"
+#include "audiosource.h"
 
 /**
  * @brief Recorder for audio data from the specified source
  */
-class Recorder : public QObject
+class Recorder : public AudioSource
 {
     Q_OBJECT
 
@@ -44,11 +44,6 @@ public:
 
     void setDevice(const QAudioDeviceInfo &audioDeviceInfo);
 
-signals:
-
-    void log(LogType logType, const QString &message);
-    void audioData(const QByteArray &data);
-
 private:
 
     QAudioInput *mAudioInput;
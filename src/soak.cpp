@@ -0,0 +1,134 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Nathan Osman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <cstdio>
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QTimer>
+#include <QUrl>
+
+#include "soakrunner.h"
+#include "trace.h"
+
+// Headless runner that publishes many streams from a file, for soak tests
+
+int main(int argc, char **argv)
+{
+    QCoreApplication::setApplicationName("Audio Streamer Soak");
+    QCoreApplication::setOrganizationName("Nathan Osman");
+    QCoreApplication::setOrganizationDomain("com.nathanosman");
+
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Publish many audio streams from a WAV or raw PCM file");
+    parser.addHelpOption();
+    parser.addPositionalArgument("url", "RTMP URL; each stream appends -<n> to the stream key");
+
+    QCommandLineOption fileOption({"f", "file"}, "File to play back on every stream", "file");
+    QCommandLineOption streamsOption({"n", "streams"}, "Number of streams", "count", "1");
+    QCommandLineOption backendOption({"b", "backend"}, "Transport backend: qt, epoll or io_uring", "backend", "epoll");
+    QCommandLineOption durationOption({"d", "duration"}, "Seconds to run for, or 0 to run until killed", "seconds", "0");
+    QCommandLineOption fastOption("fast", "Send blocks as fast as possible instead of in real time");
+    QCommandLineOption adpcmOption("adpcm", "Compress the audio with ADPCM instead of sending PCM");
+    QCommandLineOption insecureOption("insecure", "Do not verify the certificate for RTMPS");
+    QCommandLineOption noKtlsOption("no-ktls", "Encrypt RTMPS in userspace even if kTLS is available");
+    parser.addOptions({
+        fileOption,
+        streamsOption,
+        backendOption,
+        durationOption,
+        fastOption,
+        adpcmOption,
+        insecureOption,
+        noKtlsOption
+    });
+    parser.process(app);
+
+    const QStringList arguments = parser.positionalArguments();
+    const int streamCount = parser.value(streamsOption).toInt();
+    if (arguments.count() != 1 || !parser.isSet(fileOption) || streamCount < 1) {
+        parser.showHelp(1);
+    }
+
+    const QString backendName = parser.value(backendOption);
+    Transport::Backend backend;
+    if (backendName == "qt") {
+        backend = Transport::Backend::Qt;
+    } else if (backendName == "epoll") {
+        backend = Transport::Backend::Epoll;
+    } else if (backendName == "io_uring") {
+        backend = Transport::Backend::IoUring;
+    } else {
+        fprintf(stderr, "unknown backend \"%s\"\n", qPrintable(backendName));
+        return 1;
+    }
+    const Transport::Backend fallback = Transport::fallback(backend);
+    if (fallback != backend) {
+        fprintf(stderr, "%s is not available, falling back to %s\n", qPrintable(backendName),
+                fallback == Transport::Backend::Epoll ? "epoll" : "qt");
+    }
+
+    // Same as the GUI: tracing is enabled by naming the file to dump to
+    const QString traceFileName = QString::fromLocal8Bit(qgetenv("AUDIO_STREAMER_TRACE"));
+    if (!traceFileName.isEmpty()) {
+        Trace::setEnabled(true);
+        Trace::setThreadName("main");
+        Trace::dumpOnSignal(traceFileName);
+    }
+
+    SoakRunner runner(backend);
+    runner.setRealTime(!parser.isSet(fastOption));
+    runner.setCodec(parser.isSet(adpcmOption) ? EncodePool::Codec::Adpcm : EncodePool::Codec::Pcm);
+    runner.setVerifyPeer(!parser.isSet(insecureOption));
+    runner.setTlsOffload(!parser.isSet(noKtlsOption));
+
+    QObject::connect(&runner, &SoakRunner::log, [](LogType logType, const QString &message) {
+        fprintf(logType == LogType::Error ? stderr : stdout, "%s\n", qPrintable(message));
+        fflush(stdout);
+    });
+
+    if (!runner.start(QUrl(arguments.first()), parser.value(fileOption), streamCount)) {
+        return 1;
+    }
+
+    const int duration = parser.value(durationOption).toInt();
+    if (duration > 0) {
+        QTimer::singleShot(duration * 1000, &runner, [&runner]() {
+            runner.stop();
+
+            // Give the clients a moment to write out what they have
+            QTimer::singleShot(1000, QCoreApplication::instance(), &QCoreApplication::quit);
+        });
+    }
+
+    int ret = app.exec();
+
+    if (Trace::isEnabled()) {
+        Trace::dump(traceFileName);
+    }
+
+    return ret;
+}
@@ -0,0 +1,128 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Nathan Osman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "client.h"
+#include "filesource.h"
+#include "soakrunner.h"
+
+const int ReportInterval = 10000;
+
+SoakRunner::SoakRunner(Transport::Backend backend, QObject *parent)
+    : QObject(parent)
+    , mBackend(backend)
+    , mRealTime(true)
+    , mCodec(EncodePool::Codec::Pcm)
+    , mVerifyPeer(true)
+    , mTlsOffload(true)
+    , mBlocksSent(0)
+    , mErrorCount(0)
+{
+    connect(&mReportTimer, &QTimer::timeout, this, &SoakRunner::onReportTimeout);
+
+    // Encoded blocks are delivered on this thread, in order for each stream
+    connect(&mEncodePool, &EncodePool::encoded, this, [this](int streamId, const QByteArray &data, quint32 timestamp, quint64 blockId) {
+        Client *client = mClients.value(streamId);
+        if (client && client->isPublishing()) {
+            client->sendAudio(data, timestamp, blockId);
+            ++mBlocksSent;
+        }
+    });
+}
+
+bool SoakRunner::start(const QUrl &url, const QString &fileName, int streamCount)
+{
+    for (int i = 0; i < streamCount; ++i) {
+        FileSource *source = new FileSource(this);
+        connect(source, &FileSource::log, this, &SoakRunner::log);
+        if (!source->open(fileName)) {
+            delete source;
+            return false;
+        }
+
+        const int streamId = mEncodePool.addStream(mCodec);
+        connect(source, &FileSource::audioData, this, [this, streamId](const QByteArray &data, const QSharedPointer<MappedFile> &mapping) {
+            mEncodePool.submit(streamId, data, mapping);
+        });
+
+        Client *client = new Client(mBackend, this);
+        client->setVerifyPeer(mVerifyPeer);
+        client->setTlsOffload(mTlsOffload);
+
+        // Only errors are passed on, since every stream logs the same progress
+        connect(client, &Client::log, this, [this, i](LogType logType, const QString &message) {
+            if (logType == LogType::Error) {
+                ++mErrorCount;
+                emit log(logType, QString("stream %1: %2").arg(i).arg(message));
+            }
+        });
+
+        mSources.append(source);
+        mClients.insert(streamId, client);
+
+        client->start(streamUrl(url, i));
+        source->start(mRealTime);
+    }
+
+    emit log(LogType::Info, QString("started %1 stream(s) from %2").arg(streamCount).arg(fileName));
+
+    mReportTimer.start(ReportInterval);
+    return true;
+}
+
+void SoakRunner::stop()
+{
+    mReportTimer.stop();
+    onReportTimeout();
+
+    for (FileSource *source : mSources) {
+        source->stop();
+    }
+    for (Client *client : mClients) {
+        client->stop();
+    }
+}
+
+void SoakRunner::onReportTimeout()
+{
+    int publishingCount = 0;
+    for (Client *client : mClients) {
+        if (client->isPublishing()) {
+            ++publishingCount;
+        }
+    }
+
+    emit log(LogType::Info, QString("%1/%2 streams publishing, %3 blocks sent, %4 errors")
+             .arg(publishingCount)
+             .arg(mClients.count())
+             .arg(mBlocksSent)
+             .arg(mErrorCount));
+}
+
+QUrl SoakRunner::streamUrl(const QUrl &url, int index)
+{
+    // Every stream gets a stream key of its own on the same application
+    QUrl result(url);
+    result.setPath(QString("%1-%2").arg(url.path()).arg(index));
+    return result;
+}
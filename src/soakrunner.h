@@ -0,0 +1,93 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Nathan Osman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef SOAKRUNNER_H
+#define SOAKRUNNER_H
+
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QTimer>
+#include <QUrl>
+
+#include "encodepool.h"
+#include "log.h"
+#include "transport.h"
+
+class Client;
+class FileSource;
+
+/**
+ * @brief Publishes many streams from a file for soak testing
+ *
+ * Each stream plays the file through its own FileSource, has its blocks
+ * encoded on a shared EncodePool and publishes them with its own Client. The
+ * sources share a single mapping of the file. Progress is reported
+ * periodically through the log signal.
+ */
+class SoakRunner : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    explicit SoakRunner(Transport::Backend backend, QObject *parent = nullptr);
+
+    inline void setRealTime(bool realTime) { mRealTime = realTime; }
+    inline void setCodec(EncodePool::Codec codec) { mCodec = codec; }
+    inline void setVerifyPeer(bool verifyPeer) { mVerifyPeer = verifyPeer; }
+    inline void setTlsOffload(bool tlsOffload) { mTlsOffload = tlsOffload; }
+
+    bool start(const QUrl &url, const QString &fileName, int streamCount);
+    void stop();
+
+signals:
+
+    void log(LogType logType, const QString &message);
+
+private slots:
+
+    void onReportTimeout();
+
+private:
+
+    static QUrl streamUrl(const QUrl &url, int index);
+
+    Transport::Backend mBackend;
+    bool mRealTime;
+    EncodePool::Codec mCodec;
+    bool mVerifyPeer;
+    bool mTlsOffload;
+
+    EncodePool mEncodePool;
+    QList<FileSource*> mSources;
+    QHash<int, Client*> mClients;
+
+    QTimer mReportTimer;
+
+    qint64 mBlocksSent;
+    int mErrorCount;
+};
+
+#endif // SOAKRUNNER_H
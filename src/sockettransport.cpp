@@ -0,0 +1,438 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Nathan Osman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <QObject>
+
+#include "sockettransport.h"
+
+#ifdef HAVE_OPENSSL
+#  include "tlssession.h"
+#endif
+
+// Unsent data the kernel may hold before the socket stops accepting writes
+const int NotSentLowWatermark = 16384;
+
+inline QString errorString(int errorCode)
+{
+    return QString::fromLocal8Bit(strerror(errorCode));
+}
+
+SocketTransport::SocketTransport()
+    : mFd(-1)
+    , mState(StateIdle)
+    , mAddresses(nullptr)
+    , mNextAddress(nullptr)
+    , mSecure(false)
+    , mPendingOffset(0)
+    , mPendingBytes(0)
+    , mFlushing(false)
+    , mClosing(false)
+{
+}
+
+SocketTransport::~SocketTransport()
+{
+    // Subclasses must call closeSocket() while their backend still exists
+    Q_ASSERT(mFd == -1);
+}
+
+void SocketTransport::connectToHost(const QString &hostName, quint16 port, bool secure)
+{
+    closeSocket();
+
+#ifndef HAVE_OPENSSL
+    if (secure) {
+        fail(QObject::tr("TLS is not supported by this backend"));
+        return;
+    }
+#endif
+
+    mSecure = secure;
+    mHostName = hostName;
+
+    // Resolution blocks, which is acceptable for the headless use case
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICSERV;
+
+    const int ret = getaddrinfo(hostName.toUtf8().constData(),
+                                QByteArray::number(port).constData(),
+                                &hints,
+                                &mAddresses);
+    if (ret) {
+        mAddresses = nullptr;
+        fail(QString::fromLocal8Bit(gai_strerror(ret)));
+        return;
+    }
+
+    mNextAddress = mAddresses;
+    connectToNext();
+}
+
+void SocketTransport::disconnectFromHost()
+{
+#ifdef HAVE_OPENSSL
+    // Without kTLS, close_notify is queued behind the pending data
+    if (mTls && mState == StateConnected && !mTls->isKernelOffloaded()) {
+        mTls->shutdown();
+        queue(mTls->takeOutput());
+    }
+#endif
+
+    // Like QAbstractSocket, finish writing pending data first
+    if (mState == StateConnected && mPendingBytes) {
+        mClosing = true;
+        flush();
+        return;
+    }
+
+    shutdownSocket();
+}
+
+void SocketTransport::write(const QByteArray &data)
+{
+    if (mFd == -1 || data.isEmpty()) {
+        return;
+    }
+
+#ifdef HAVE_OPENSSL
+    // With kTLS, the kernel encrypts whatever is written to the socket
+    if (mTls && !mTls->isKernelOffloaded()) {
+        mTls->encrypt(data);
+        queue(mTls->takeOutput());
+        return;
+    }
+#endif
+
+    queue(data);
+}
+
+void SocketTransport::flush()
+{
+    if (mState != StateConnected || mPending.isEmpty()) {
+        return;
+    }
+
+    // Progress made here is not reported through the written callback,
+    // since the caller is the one writing
+    mFlushing = true;
+    startSending();
+    mFlushing = false;
+}
+
+qint64 SocketTransport::bytesToWrite() const
+{
+    return mPendingBytes;
+}
+
+bool SocketTransport::attach(int fd)
+{
+    closeSocket();
+
+    const int flags = fcntl(fd, F_GETFL);
+    if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        return false;
+    }
+
+    mFd = fd;
+    mSecure = false;
+    if (!attachSocket()) {
+        mFd = -1;
+        return false;
+    }
+
+    establish();
+    return true;
+}
+
+void SocketTransport::onReady(bool, bool writable)
+{
+    if (mState == StateConnecting && writable) {
+        int errorCode = 0;
+        socklen_t length = sizeof (errorCode);
+        getsockopt(mFd, SOL_SOCKET, SO_ERROR, &errorCode, &length);
+        if (errorCode && mNextAddress) {
+            detachSocket();
+            mFd = -1;
+            connectToNext();
+        } else if (errorCode) {
+            onClosed(errorCode);
+        } else {
+            establish();
+        }
+    } else if (mState == StateHandshaking && writable) {
+        continueHandshake();
+    }
+}
+
+void SocketTransport::onReceived(const char *data, qint64 size)
+{
+#ifdef HAVE_OPENSSL
+    if (mTls) {
+        if (!mTls->feed(data, size)) {
+            fail(mTls->errorString());
+            return;
+        }
+
+        if (mState == StateHandshaking) {
+            continueHandshake();
+            return;
+        }
+
+        QByteArray plaintext;
+        if (mTls->decrypt(plaintext) == TlsSession::Failed) {
+            fail(mTls->errorString());
+            return;
+        }
+
+        // Reading may produce records of its own, such as key updates
+        queue(mTls->takeOutput());
+
+        if (!plaintext.isEmpty()) {
+            received(plaintext.constData(), plaintext.size());
+        }
+        return;
+    }
+#endif
+
+    received(data, size);
+}
+
+void SocketTransport::onSent(qint64 size)
+{
+    mPendingBytes -= size;
+
+    // Drop every buffer that was completely written
+    while (size > 0) {
+        const qint64 remaining = mPending.first().size() - mPendingOffset;
+        if (size < remaining) {
+            mPendingOffset += size;
+            break;
+        }
+        size -= remaining;
+        mPending.removeFirst();
+        mPendingOffset = 0;
+    }
+
+    if (mClosing && !mPendingBytes) {
+        shutdownSocket();
+        return;
+    }
+
+    if (!mFlushing) {
+        written();
+    }
+}
+
+void SocketTransport::onClosed(int errorCode)
+{
+    fail(errorCode ? errorString(errorCode) : QObject::tr("connection closed by host"));
+}
+
+int SocketTransport::pendingIovecs(iovec *iov, int count, QList<QByteArray> *retain) const
+{
+    int i = 0;
+    for (; i < mPending.size() && i < count; ++i) {
+        const QByteArray &data = mPending.at(i);
+        const qint64 offset = i ? 0 : mPendingOffset;
+        iov[i].iov_base = const_cast<char*>(data.constData() + offset);
+        iov[i].iov_len = static_cast<size_t>(data.size() - offset);
+        if (retain) {
+            retain->append(data);
+        }
+    }
+    return i;
+}
+
+void SocketTransport::closeSocket()
+{
+    if (mFd != -1) {
+        detachSocket();
+        mFd = -1;
+    }
+
+    if (mAddresses) {
+        freeaddrinfo(mAddresses);
+        mAddresses = nullptr;
+        mNextAddress = nullptr;
+    }
+
+    mState = StateIdle;
+    mTls.reset();
+    mPending.clear();
+    mPendingOffset = 0;
+    mPendingBytes = 0;
+    mClosing = false;
+}
+
+void SocketTransport::connectToNext()
+{
+    // Each address is tried in the order getaddrinfo() returned them until
+    // one is accepted, so a host with an unreachable IPv6 address still
+    // connects over IPv4
+    int errorCode = 0;
+    while (mNextAddress) {
+        const addrinfo *address = mNextAddress;
+        mNextAddress = mNextAddress->ai_next;
+
+        mFd = ::socket(address->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (mFd == -1) {
+            errorCode = errno;
+            continue;
+        }
+
+        // Control messages are small and must not be held back by Nagle
+        int enabled = 1;
+        setsockopt(mFd, IPPROTO_TCP, TCP_NODELAY, &enabled, sizeof (enabled));
+
+        // Keep the backlog here rather than in the kernel, where control
+        // messages could no longer be sent ahead of queued audio
+        const int lowWatermark = NotSentLowWatermark;
+        setsockopt(mFd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowWatermark, sizeof (lowWatermark));
+
+        const int ret = ::connect(mFd, address->ai_addr, address->ai_addrlen);
+        if (ret == -1 && errno != EINPROGRESS) {
+            errorCode = errno;
+            ::close(mFd);
+            mFd = -1;
+            continue;
+        }
+
+        if (!attachSocket()) {
+            const int attachError = errno;
+            ::close(mFd);
+            mFd = -1;
+            fail(errorString(attachError));
+            return;
+        }
+
+        if (ret == 0) {
+            establish();
+        } else {
+            mState = StateConnecting;
+            watch(false, true);
+        }
+        return;
+    }
+
+    fail(errorString(errorCode));
+}
+
+void SocketTransport::establish()
+{
+    log(LogType::Success, "connected to host");
+
+    startReceiving();
+
+#ifdef HAVE_OPENSSL
+    // For RTMPS, the RTMP handshake must wait until TLS is established
+    if (mSecure) {
+        log(LogType::Info, "negotiating TLS...");
+
+        mState = StateHandshaking;
+        mTls.reset(new TlsSession(mFd, mHostName, verifyPeer(), tlsOffload()));
+        if (!mTls->isValid()) {
+            fail(mTls->errorString());
+            return;
+        }
+
+        continueHandshake();
+        return;
+    }
+#endif
+
+    mState = StateConnected;
+    connected();
+}
+
+void SocketTransport::continueHandshake()
+{
+#ifdef HAVE_OPENSSL
+    switch (mTls->handshake()) {
+    case TlsSession::WantRead:
+        // Resumed from onReceived()
+        break;
+    case TlsSession::WantWrite:
+        watch(false, true);
+        break;
+    case TlsSession::Failed:
+        fail(mTls->errorString());
+        break;
+    case TlsSession::Done:
+        log(LogType::Success, QString("TLS session established (%1)")
+            .arg(mTls->cipherName()));
+        if (mTls->isResumed()) {
+            log(LogType::Info, "resumed previous TLS session");
+        }
+        log(LogType::Info, mTls->isKernelOffloaded() ?
+                "TLS encryption offloaded to the kernel" :
+                "kTLS unavailable, encrypting in userspace");
+
+        mState = StateConnected;
+        connected();
+        break;
+    }
+#endif
+}
+
+void SocketTransport::shutdownSocket()
+{
+#ifdef HAVE_OPENSSL
+    // With kTLS, close_notify goes straight to the socket once the data
+    // before it has been sent
+    if (mTls && mState == StateConnected && mTls->isKernelOffloaded()) {
+        mTls->shutdown();
+    }
+#endif
+
+    closeSocket();
+}
+
+void SocketTransport::queue(const QByteArray &data)
+{
+    if (data.isEmpty()) {
+        return;
+    }
+
+    mPending.append(data);
+    mPendingBytes += data.size();
+}
+
+void SocketTransport::fail(const QString &errorMessage)
+{
+    closeSocket();
+    failed(errorMessage);
+}
@@ -0,0 +1,146 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Nathan Osman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef SOCKETTRANSPORT_H
+#define SOCKETTRANSPORT_H
+
+#include <QList>
+#include <QScopedPointer>
+
+#include "transport.h"
+
+struct addrinfo;
+struct iovec;
+
+class TlsSession;
+
+/**
+ * @brief Base for transports that drive a raw socket from a Linux I/O backend
+ *
+ * This class owns the connection state and the queue of pending writes.
+ * Subclasses only move bytes: they report readiness, received spans and
+ * completed writes back through the protected on*() methods.
+ *
+ * Secure connections use OpenSSL on the socket itself. When the kernel
+ * supports kTLS, the transmit path is offloaded and pending writes are sent
+ * unmodified; otherwise they are encrypted before being queued.
+ */
+class SocketTransport : public Transport
+{
+public:
+
+    SocketTransport();
+    virtual ~SocketTransport();
+
+    virtual void connectToHost(const QString &hostName, quint16 port, bool secure);
+    virtual void disconnectFromHost();
+
+    virtual void write(const QByteArray &data);
+    virtual void flush();
+
+    virtual qint64 bytesToWrite() const;
+
+    bool attach(int fd);
+
+    inline bool isConnected() const { return mState == StateConnected; }
+
+protected:
+
+    /**
+     * @brief Register the socket with the backend
+     */
+    virtual bool attachSocket() = 0;
+
+    /**
+     * @brief Stop all I/O on the socket and close it
+     */
+    virtual void detachSocket() = 0;
+
+    /**
+     * @brief Report the next time the socket becomes readable or writable
+     */
+    virtual void watch(bool readable, bool writable) = 0;
+
+    /**
+     * @brief Continuously read from the socket and report received spans
+     */
+    virtual void startReceiving() = 0;
+
+    /**
+     * @brief Write the pending queue, reporting progress with onSent()
+     */
+    virtual void startSending() = 0;
+
+    void onReady(bool readable, bool writable);
+    void onReceived(const char *data, qint64 size);
+    void onSent(qint64 size);
+    void onClosed(int errorCode);
+
+    /**
+     * @brief Describe the pending queue as up to count iovecs
+     *
+     * If retain is provided, the byte arrays referenced by the iovecs are
+     * appended to it so that an asynchronous write can keep them alive.
+     */
+    int pendingIovecs(iovec *iov, int count, QList<QByteArray> *retain = nullptr) const;
+
+    void closeSocket();
+
+    inline int socket() const { return mFd; }
+
+private:
+
+    void connectToNext();
+    void establish();
+    void continueHandshake();
+    void shutdownSocket();
+    void queue(const QByteArray &data);
+    void fail(const QString &errorMessage);
+
+    int mFd;
+
+    enum {
+        StateIdle = 0,
+        StateConnecting,
+        StateHandshaking,
+        StateConnected
+    } mState;
+
+    // Addresses that remain to be tried, from getaddrinfo()
+    addrinfo *mAddresses;
+    addrinfo *mNextAddress;
+
+    bool mSecure;
+    QString mHostName;
+    QScopedPointer<TlsSession> mTls;
+
+    QList<QByteArray> mPending;
+    qint64 mPendingOffset;
+    qint64 mPendingBytes;
+
+    bool mFlushing;
+    bool mClosing;
+};
+
+#endif // SOCKETTRANSPORT_H
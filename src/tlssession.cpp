@@ -0,0 +1,306 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Nathan Osman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <csignal>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+
+#include <QHash>
+#include <QMutex>
+#include <QObject>
+#include <QScopedPointer>
+
+#include "tlssession.h"
+
+// Sessions are shared between threads and keyed by host name
+static QMutex sessionMutex;
+static QHash<QString, SSL_SESSION*> sessions;
+
+inline bool isAddress(const QByteArray &hostName)
+{
+    in6_addr address;
+    return inet_pton(AF_INET, hostName.constData(), &address) == 1 ||
+            inet_pton(AF_INET6, hostName.constData(), &address) == 1;
+}
+
+/**
+ * @brief Hold back SIGPIPE while OpenSSL writes to the socket
+ *
+ * OpenSSL writes with write() rather than send(MSG_NOSIGNAL), so a peer
+ * that has gone away would otherwise terminate the process.
+ */
+class SigPipeBlocker
+{
+public:
+
+    SigPipeBlocker() {
+        sigemptyset(&mSignals);
+        sigaddset(&mSignals, SIGPIPE);
+
+        sigset_t pending;
+        sigpending(&pending);
+        mWasPending = sigismember(&pending, SIGPIPE);
+
+        pthread_sigmask(SIG_BLOCK, &mSignals, &mPrevious);
+    }
+
+    ~SigPipeBlocker() {
+        if (!mWasPending) {
+            const timespec timeout{};
+            sigtimedwait(&mSignals, nullptr, &timeout);
+        }
+        pthread_sigmask(SIG_SETMASK, &mPrevious, nullptr);
+    }
+
+private:
+
+    sigset_t mSignals;
+    sigset_t mPrevious;
+    bool mWasPending;
+};
+
+TlsSession::TlsSession(int fd, const QString &hostName, bool verifyPeer, bool kernelOffload)
+    : mSsl(nullptr)
+    , mReadBio(nullptr)
+    , mWriteBio(nullptr)
+    , mKernelOffloaded(false)
+    , mHostName(hostName)
+{
+    SSL_CTX *ctx = context();
+    SSL *ssl = ctx ? SSL_new(ctx) : nullptr;
+    if (!ssl) {
+        mErrorString = QObject::tr("unable to initialize TLS");
+        return;
+    }
+
+    // Handshake records are written to the socket by OpenSSL itself
+    mReadBio = BIO_new(BIO_s_mem());
+    SSL_set0_rbio(ssl, mReadBio);
+    SSL_set0_wbio(ssl, BIO_new_socket(fd, BIO_NOCLOSE));
+    SSL_set_app_data(ssl, this);
+
+#ifdef SSL_OP_ENABLE_KTLS
+    if (!kernelOffload) {
+        SSL_clear_options(ssl, SSL_OP_ENABLE_KTLS);
+    }
+#else
+    Q_UNUSED(kernelOffload)
+#endif
+
+    // SNI is only sent for names, never for addresses
+    const QByteArray host = hostName.toUtf8();
+    const bool address = isAddress(host);
+    if (!address) {
+        SSL_set_tlsext_host_name(ssl, host.constData());
+    }
+
+    if (verifyPeer) {
+        SSL_set_verify(ssl, SSL_VERIFY_PEER, nullptr);
+        if (address) {
+            X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(ssl), host.constData());
+        } else {
+            SSL_set1_host(ssl, host.constData());
+        }
+    }
+
+    {
+        QMutexLocker locker(&sessionMutex);
+        SSL_SESSION *session = sessions.value(hostName);
+        if (session) {
+            SSL_set_session(ssl, session);
+        }
+    }
+
+    SSL_set_connect_state(ssl);
+    mSsl = ssl;
+}
+
+TlsSession::~TlsSession()
+{
+    if (mSsl) {
+        SSL_free(mSsl);
+    }
+}
+
+TlsSession::Result TlsSession::handshake()
+{
+    SigPipeBlocker blocker;
+    ERR_clear_error();
+
+    const int ret = SSL_do_handshake(mSsl);
+    if (ret != 1) {
+        return result(ret);
+    }
+
+    // Without kTLS, records are encrypted into memory and sent by the caller;
+    // OpenSSL only supports it from 3.0 onwards
+#ifdef SSL_OP_ENABLE_KTLS
+    mKernelOffloaded = BIO_get_ktls_send(SSL_get_wbio(mSsl));
+#else
+    mKernelOffloaded = false;
+#endif
+    if (!mKernelOffloaded) {
+        mWriteBio = BIO_new(BIO_s_mem());
+        SSL_set0_wbio(mSsl, mWriteBio);
+    }
+
+    return Done;
+}
+
+bool TlsSession::feed(const char *data, qint64 size)
+{
+    if (BIO_write(mReadBio, data, static_cast<int>(size)) != size) {
+        mErrorString = QObject::tr("unable to buffer TLS records");
+        return false;
+    }
+    return true;
+}
+
+TlsSession::Result TlsSession::decrypt(QByteArray &plaintext)
+{
+    // Reading can write records of its own, which with kTLS go to the socket
+    QScopedPointer<SigPipeBlocker> blocker(mKernelOffloaded ? new SigPipeBlocker : nullptr);
+
+    char buffer[16384];
+    forever {
+        ERR_clear_error();
+
+        const int ret = SSL_read(mSsl, buffer, sizeof (buffer));
+        if (ret > 0) {
+            plaintext.append(buffer, ret);
+            continue;
+        }
+
+        const Result readResult = result(ret);
+        return readResult == Failed ? Failed : Done;
+    }
+}
+
+void TlsSession::encrypt(const QByteArray &plaintext)
+{
+    // Writes to a memory BIO always complete
+    ERR_clear_error();
+    SSL_write(mSsl, plaintext.constData(), plaintext.size());
+}
+
+void TlsSession::shutdown()
+{
+    // OpenSSL discards sessions from connections that were not closed cleanly
+    SigPipeBlocker blocker;
+    ERR_clear_error();
+    SSL_shutdown(mSsl);
+}
+
+QByteArray TlsSession::takeOutput()
+{
+    if (!mWriteBio) {
+        return QByteArray();
+    }
+
+    QByteArray output(static_cast<int>(BIO_ctrl_pending(mWriteBio)), Qt::Uninitialized);
+    if (!output.isEmpty()) {
+        BIO_read(mWriteBio, output.data(), output.size());
+    }
+    return output;
+}
+
+bool TlsSession::isResumed() const
+{
+    return SSL_session_reused(mSsl);
+}
+
+QString TlsSession::cipherName() const
+{
+    return QString("%1, %2")
+            .arg(QString::fromLatin1(SSL_get_version(mSsl)))
+            .arg(QString::fromLatin1(SSL_get_cipher_name(mSsl)));
+}
+
+SSL_CTX *TlsSession::context()
+{
+    static SSL_CTX *ctx = []() {
+        SSL_CTX *ctx = SSL_CTX_new(TLS_client_method());
+        if (ctx) {
+            SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+            SSL_CTX_set_default_verify_paths(ctx);
+
+            // OpenSSL moves the keys into the kernel when it is able to
+#ifdef SSL_OP_ENABLE_KTLS
+            SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+#endif
+
+            // Sessions are kept per host instead of in OpenSSL's own cache
+            SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+            SSL_CTX_sess_set_new_cb(ctx, &TlsSession::onNewSession);
+        }
+        return ctx;
+    }();
+    return ctx;
+}
+
+int TlsSession::onNewSession(SSL *ssl, SSL_SESSION *session)
+{
+    const TlsSession *tlsSession = static_cast<const TlsSession*>(SSL_get_app_data(ssl));
+
+    QMutexLocker locker(&sessionMutex);
+    SSL_SESSION *previous = sessions.take(tlsSession->mHostName);
+    if (previous) {
+        SSL_SESSION_free(previous);
+    }
+    sessions.insert(tlsSession->mHostName, session);
+
+    // The reference passed in is now owned by the cache
+    return 1;
+}
+
+TlsSession::Result TlsSession::result(int ret)
+{
+    switch (SSL_get_error(mSsl, ret)) {
+    case SSL_ERROR_WANT_READ:
+        return WantRead;
+    case SSL_ERROR_WANT_WRITE:
+        return WantWrite;
+    case SSL_ERROR_ZERO_RETURN:
+        mErrorString = QObject::tr("connection closed by host");
+        return Failed;
+    }
+
+    const long verifyResult = SSL_get_verify_result(mSsl);
+    if (verifyResult != X509_V_OK) {
+        mErrorString = QString::fromLatin1(X509_verify_cert_error_string(verifyResult));
+    } else {
+        char buffer[256];
+        const unsigned long error = ERR_get_error();
+        ERR_error_string_n(error, buffer, sizeof (buffer));
+        mErrorString = error ? QString::fromLatin1(buffer) : QObject::tr("TLS error");
+    }
+
+    return Failed;
+}
@@ -0,0 +1,97 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Nathan Osman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef TLSSESSION_H
+#define TLSSESSION_H
+
+#include <QByteArray>
+#include <QString>
+
+typedef struct bio_st BIO;
+typedef struct ssl_ctx_st SSL_CTX;
+typedef struct ssl_session_st SSL_SESSION;
+typedef struct ssl_st SSL;
+
+/**
+ * @brief Client side of a TLS connection on a raw socket
+ *
+ * The handshake writes directly to the socket so that OpenSSL can hand the
+ * transmit keys over to the kernel (kTLS) once it completes. In that case,
+ * application data is written to the socket unmodified and encrypted by the
+ * kernel. Otherwise it is encrypted here and returned for the caller to
+ * send.
+ *
+ * Received data is always fed in by the caller and decrypted here. This
+ * keeps the receive path the same for every backend and means that session
+ * tickets sent after the handshake (as with TLS 1.3) are still processed.
+ * Sessions are cached per host and resumed on the next connection.
+ */
+class TlsSession
+{
+public:
+
+    enum Result {
+        Done,
+        WantRead,
+        WantWrite,
+        Failed
+    };
+
+    TlsSession(int fd, const QString &hostName, bool verifyPeer, bool kernelOffload);
+    ~TlsSession();
+
+    inline bool isValid() const { return mSsl; }
+
+    Result handshake();
+
+    bool feed(const char *data, qint64 size);
+    Result decrypt(QByteArray &plaintext);
+    void encrypt(const QByteArray &plaintext);
+    void shutdown();
+
+    QByteArray takeOutput();
+
+    inline bool isKernelOffloaded() const { return mKernelOffloaded; }
+    bool isResumed() const;
+    QString cipherName() const;
+
+    inline QString errorString() const { return mErrorString; }
+
+private:
+
+    static SSL_CTX *context();
+    static int onNewSession(SSL *ssl, SSL_SESSION *session);
+
+    Result result(int ret);
+
+    SSL *mSsl;
+    BIO *mReadBio;
+    BIO *mWriteBio;
+    bool mKernelOffloaded;
+
+    QString mHostName;
+    QString mErrorString;
+};
+
+#endif // TLSSESSION_H
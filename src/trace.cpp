@@ -0,0 +1,305 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Nathan Osman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <chrono>
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QList>
+#include <QMutex>
+#include <QMutexLocker>
+
+#ifdef Q_OS_UNIX
+#  include <csignal>
+#  include <sys/socket.h>
+#  include <unistd.h>
+#  include <QSocketNotifier>
+#endif
+
+#include "trace.h"
+
+/**
+ * @brief Slot for a single event in a ring buffer
+ *
+ * The fields are atomics only so that a dump may read them while the owning
+ * thread writes; relaxed accesses compile to plain loads and stores.
+ */
+struct TraceEvent
+{
+    std::atomic<quint64> sequence;
+    std::atomic<const char*> name;
+    std::atomic<qint64> start;
+    std::atomic<qint64> duration;
+    std::atomic<quint64> id;
+    std::atomic<char> phase;
+    std::atomic<int> threadId;
+};
+
+/**
+ * @brief Ring buffer of events written by a single thread at a time
+ *
+ * Each slot is a seqlock: the writer marks it odd while writing event i and
+ * stores 2 * (i + 1) once done. A dump only keeps a slot if the sequence
+ * matches the event it expects before and after reading it, so events that
+ * are half written or were overwritten by a wrapping writer are skipped.
+ *
+ * When a thread exits, its buffer is handed to the next new thread. Events
+ * carry the id of the thread that wrote them, so those from the exited
+ * thread can still be dumped until they are overwritten.
+ */
+struct TraceBuffer
+{
+    static const quint64 Capacity = 65536;
+
+    std::atomic<quint64> head;
+    TraceEvent events[Capacity];
+};
+
+std::atomic<bool> Trace::sEnabled(false);
+std::atomic<quint64> Trace::sNextBlockId(1);
+
+static QList<TraceBuffer*> traceBuffers;
+static QList<TraceBuffer*> freeTraceBuffers;
+static QMutex traceBuffersMutex;
+
+static int nextThreadId = 1;
+static QHash<int, QString> threadNames;
+
+/**
+ * @brief Buffer owned by the current thread, released when it exits
+ */
+struct ThreadBuffer
+{
+    ~ThreadBuffer() {
+        if (buffer) {
+            QMutexLocker locker(&traceBuffersMutex);
+            freeTraceBuffers.append(buffer);
+        }
+    }
+
+    TraceBuffer *buffer = nullptr;
+    int threadId = 0;
+};
+
+static thread_local ThreadBuffer threadBuffer;
+
+static ThreadBuffer &currentBuffer()
+{
+    if (!threadBuffer.buffer) {
+        QMutexLocker locker(&traceBuffersMutex);
+        if (freeTraceBuffers.isEmpty()) {
+            TraceBuffer *buffer = new TraceBuffer;
+            buffer->head.store(0, std::memory_order_relaxed);
+            for (TraceEvent &event : buffer->events) {
+                event.sequence.store(0, std::memory_order_relaxed);
+            }
+            traceBuffers.append(buffer);
+            threadBuffer.buffer = buffer;
+        } else {
+            threadBuffer.buffer = freeTraceBuffers.takeLast();
+        }
+        threadBuffer.threadId = nextThreadId++;
+    }
+    return threadBuffer;
+}
+
+void Trace::setEnabled(bool enabled)
+{
+    sEnabled.store(enabled, std::memory_order_relaxed);
+}
+
+qint64 Trace::now()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+    ).count();
+}
+
+// Writes one slot of the current thread's buffer, see TraceBuffer
+static void recordEvent(char phase, const char *name, qint64 start, qint64 duration, quint64 id)
+{
+    ThreadBuffer &threadBuffer = currentBuffer();
+    TraceBuffer *buffer = threadBuffer.buffer;
+
+    const quint64 head = buffer->head.load(std::memory_order_relaxed);
+    TraceEvent &event = buffer->events[head % TraceBuffer::Capacity];
+
+    event.sequence.store(2 * head + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    event.name.store(name, std::memory_order_relaxed);
+    event.start.store(start, std::memory_order_relaxed);
+    event.duration.store(duration, std::memory_order_relaxed);
+    event.id.store(id, std::memory_order_relaxed);
+    event.phase.store(phase, std::memory_order_relaxed);
+    event.threadId.store(threadBuffer.threadId, std::memory_order_relaxed);
+
+    event.sequence.store(2 * (head + 1), std::memory_order_release);
+    buffer->head.store(head + 1, std::memory_order_release);
+}
+
+void Trace::record(const char *name, qint64 start, qint64 duration, quint64 id)
+{
+    recordEvent('X', name, start, duration, id);
+}
+
+void Trace::recordFlow(quint64 id, FlowPhase phase)
+{
+    static const char phases[] = {'s', 't', 'f'};
+    recordEvent(phases[phase], "block", now(), 0, id);
+}
+
+void Trace::setThreadName(const QString &name)
+{
+    const int threadId = currentBuffer().threadId;
+
+    QMutexLocker locker(&traceBuffersMutex);
+    threadNames.insert(threadId, name);
+}
+
+bool Trace::dump(const QString &fileName)
+{
+    const qint64 pid = QCoreApplication::applicationPid();
+    QJsonArray traceEvents;
+
+    QMutexLocker locker(&traceBuffersMutex);
+    foreach (TraceBuffer *buffer, traceBuffers) {
+        const quint64 head = buffer->head.load(std::memory_order_acquire);
+        const quint64 first = head > TraceBuffer::Capacity ? head - TraceBuffer::Capacity : 0;
+
+        for (quint64 i = first; i < head; ++i) {
+            const TraceEvent &event = buffer->events[i % TraceBuffer::Capacity];
+            const quint64 sequence = 2 * (i + 1);
+
+            if (event.sequence.load(std::memory_order_acquire) != sequence) {
+                continue;
+            }
+            const char *name = event.name.load(std::memory_order_relaxed);
+            const qint64 start = event.start.load(std::memory_order_relaxed);
+            const qint64 duration = event.duration.load(std::memory_order_relaxed);
+            const quint64 id = event.id.load(std::memory_order_relaxed);
+            const char phase = event.phase.load(std::memory_order_relaxed);
+            const int threadId = event.threadId.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (event.sequence.load(std::memory_order_relaxed) != sequence) {
+                continue;
+            }
+
+            QJsonObject traceEvent{
+                {"name", name},
+                {"ph", QString(QLatin1Char(phase))},
+                {"ts", start},
+                {"pid", pid},
+                {"tid", threadId}
+            };
+
+            if (phase == 'X') {
+                traceEvent.insert("dur", duration);
+                if (id) {
+                    traceEvent.insert("args", QJsonObject{{"block", static_cast<qint64>(id)}});
+                }
+            } else {
+
+                // Flow events attach to the span that encloses them
+                traceEvent.insert("cat", "block");
+                traceEvent.insert("id", static_cast<qint64>(id));
+                traceEvent.insert("bp", "e");
+            }
+
+            traceEvents.append(traceEvent);
+        }
+    }
+
+    for (auto i = threadNames.constBegin(); i != threadNames.constEnd(); ++i) {
+        traceEvents.append(QJsonObject{
+            {"name", "thread_name"},
+            {"ph", "M"},
+            {"pid", pid},
+            {"tid", i.key()},
+            {"args", QJsonObject{{"name", i.value()}}}
+        });
+    }
+    locker.unlock();
+
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+
+    QJsonObject root{{"traceEvents", traceEvents}};
+    return file.write(QJsonDocument(root).toJson(QJsonDocument::Compact)) != -1;
+}
+
+#ifdef Q_OS_UNIX
+
+static int signalFds[2];
+
+static void onSignal(int)
+{
+    // The socket is non-blocking; if it is full, a dump is already pending
+    const char c = 1;
+    if (::write(signalFds[0], &c, sizeof (c)) == -1) {
+        return;
+    }
+}
+
+#endif
+
+void Trace::dumpOnSignal(const QString &fileName)
+{
+#ifdef Q_OS_UNIX
+    // Only write to a socket from the signal handler; the dump itself runs
+    // from the event loop when the notifier fires
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, signalFds)) {
+        return;
+    }
+
+    QSocketNotifier *notifier = new QSocketNotifier(signalFds[1], QSocketNotifier::Read, qApp);
+    QObject::connect(notifier, qOverload<int>(&QSocketNotifier::activated), [fileName]() {
+
+        // Signals that arrived together only need a single dump
+        char buffer[64];
+        bool signalled = false;
+        while (::read(signalFds[1], buffer, sizeof (buffer)) > 0) {
+            signalled = true;
+        }
+
+        if (signalled) {
+            dump(fileName);
+        }
+    });
+
+    struct sigaction action{};
+    action.sa_handler = onSignal;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &action, nullptr);
+#else
+    Q_UNUSED(fileName)
+#endif
+}
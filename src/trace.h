@@ -0,0 +1,118 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Nathan Osman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+
+#include <QString>
+
+/**
+ * @brief Lightweight span tracing in the Chrome trace event format
+ *
+ * Spans are recorded into per-thread ring buffers without locking and can be
+ * dumped as JSON for chrome://tracing or Perfetto. When tracing is disabled,
+ * a span costs a single relaxed atomic load.
+ *
+ * Spans may carry the id of the audio block they work on. Flow events with
+ * the same id link those spans across threads, so that a block can be
+ * followed from its source through encoding to the transport.
+ */
+class Trace
+{
+public:
+
+    enum FlowPhase {
+        FlowStart,
+        FlowStep,
+        FlowEnd
+    };
+
+    static inline bool isEnabled() { return sEnabled.load(std::memory_order_relaxed); }
+    static void setEnabled(bool enabled);
+
+    static qint64 now();
+    static void record(const char *name, qint64 start, qint64 duration, quint64 id = 0);
+
+    /**
+     * @brief Allocate an id for a block, or return 0 if tracing is disabled
+     */
+    static inline quint64 newBlockId() {
+        return isEnabled() ? sNextBlockId.fetch_add(1, std::memory_order_relaxed) : 0;
+    }
+
+    /**
+     * @brief Record a flow event for the block, bound to the enclosing span
+     */
+    static inline void flow(quint64 id, FlowPhase phase) {
+        if (id && isEnabled()) {
+            recordFlow(id, phase);
+        }
+    }
+
+    static void setThreadName(const QString &name);
+
+    static bool dump(const QString &fileName);
+    static void dumpOnSignal(const QString &fileName);
+
+private:
+
+    static void recordFlow(quint64 id, FlowPhase phase);
+
+    static std::atomic<bool> sEnabled;
+    static std::atomic<quint64> sNextBlockId;
+};
+
+/**
+ * @brief Record the lifetime of this object as a span
+ *
+ * The name must be a string literal, since only the pointer is stored.
+ */
+class TraceSpan
+{
+public:
+
+    inline explicit TraceSpan(const char *name, quint64 blockId = 0)
+        : mName(Trace::isEnabled() ? name : nullptr)
+        , mStart(mName ? Trace::now() : 0)
+        , mBlockId(blockId)
+    {
+    }
+
+    inline ~TraceSpan()
+    {
+        if (mName) {
+            Trace::record(mName, mStart, Trace::now() - mStart, mBlockId);
+        }
+    }
+
+private:
+
+    const char *mName;
+    qint64 mStart;
+    quint64 mBlockId;
+};
+
+#endif // TRACE_H
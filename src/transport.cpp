@@ -0,0 +1,85 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Nathan Osman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <QtGlobal>
+
+#include "qttransport.h"
+#include "transport.h"
+
+#ifdef Q_OS_LINUX
+#  include "epolltransport.h"
+#endif
+
+#ifdef HAVE_IO_URING
+#  include "iouringtransport.h"
+#endif
+
+bool Transport::isAvailable(Backend backend)
+{
+    switch (backend) {
+    case Backend::Qt:
+        return true;
+#ifdef Q_OS_LINUX
+    case Backend::Epoll:
+        return EpollLoop::instance()->isValid();
+#endif
+#ifdef HAVE_IO_URING
+    case Backend::IoUring:
+        return IoUringLoop::instance()->isValid();
+#endif
+    default:
+        return false;
+    }
+}
+
+Transport::Backend Transport::fallback(Backend backend)
+{
+    if (backend == Backend::IoUring && !isAvailable(backend)) {
+        backend = Backend::Epoll;
+    }
+    if (!isAvailable(backend)) {
+        backend = Backend::Qt;
+    }
+    return backend;
+}
+
+Transport *Transport::create(Backend backend)
+{
+    if (!isAvailable(backend)) {
+        return nullptr;
+    }
+
+    switch (backend) {
+#ifdef Q_OS_LINUX
+    case Backend::Epoll:
+        return new EpollTransport(EpollLoop::instance());
+#endif
+#ifdef HAVE_IO_URING
+    case Backend::IoUring:
+        return new IoUringTransport(IoUringLoop::instance());
+#endif
+    default:
+        return new QtTransport;
+    }
+}
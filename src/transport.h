@@ -0,0 +1,151 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Nathan Osman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <functional>
+
+#include <QByteArray>
+#include <QString>
+
+#include "log.h"
+
+/**
+ * @brief Byte transport underneath the RTMP protocol
+ *
+ * Received data is handed to the read callback as a span that is only valid
+ * for the duration of the call. Writes are queued until flush() is called so
+ * that backends can submit them in a single batch. The written callback is
+ * invoked once queued data has been handed to the network, which lets the
+ * caller keep only a small amount of data in flight.
+ *
+ * The connected callback fires once the transport is ready for RTMP, which
+ * for secure connections is after the TLS handshake.
+ */
+class Transport
+{
+public:
+
+    enum class Backend {
+        Qt,
+        Epoll,
+        IoUring
+    };
+
+    typedef std::function<void(const char *data, qint64 size)> ReadCallback;
+    typedef std::function<void()> WrittenCallback;
+    typedef std::function<void()> ConnectedCallback;
+    typedef std::function<void(const QString &errorMessage)> ErrorCallback;
+    typedef std::function<void(LogType logType, const QString &message)> LogCallback;
+
+    static bool isAvailable(Backend backend);
+
+    /**
+     * @brief Find the backend to use in place of one that may be unavailable
+     *
+     * io_uring falls back to epoll, and epoll falls back to the Qt backend,
+     * which is always available.
+     */
+    static Backend fallback(Backend backend);
+
+    static Transport *create(Backend backend);
+
+    Transport() : mVerifyPeer(true), mTlsOffload(true) {}
+    virtual ~Transport() {}
+
+    inline void setReadCallback(const ReadCallback &callback) { mReadCallback = callback; }
+    inline void setWrittenCallback(const WrittenCallback &callback) { mWrittenCallback = callback; }
+    inline void setConnectedCallback(const ConnectedCallback &callback) { mConnectedCallback = callback; }
+    inline void setErrorCallback(const ErrorCallback &callback) { mErrorCallback = callback; }
+    inline void setLogCallback(const LogCallback &callback) { mLogCallback = callback; }
+
+    /**
+     * @brief Set whether the host certificate is verified for secure connections
+     */
+    inline void setVerifyPeer(bool verifyPeer) { mVerifyPeer = verifyPeer; }
+    inline bool verifyPeer() const { return mVerifyPeer; }
+
+    /**
+     * @brief Set whether TLS encryption may be handed to the kernel (kTLS)
+     *
+     * This only applies to the socket backends and is mostly useful for
+     * comparing the cost of encrypting in userspace.
+     */
+    inline void setTlsOffload(bool tlsOffload) { mTlsOffload = tlsOffload; }
+    inline bool tlsOffload() const { return mTlsOffload; }
+
+    virtual void connectToHost(const QString &hostName, quint16 port, bool secure) = 0;
+    virtual void disconnectFromHost() = 0;
+
+    virtual void write(const QByteArray &data) = 0;
+    virtual void flush() = 0;
+
+    virtual qint64 bytesToWrite() const = 0;
+
+protected:
+
+    inline void received(const char *data, qint64 size) {
+        if (mReadCallback) {
+            mReadCallback(data, size);
+        }
+    }
+
+    inline void written() {
+        if (mWrittenCallback) {
+            mWrittenCallback();
+        }
+    }
+
+    inline void connected() {
+        if (mConnectedCallback) {
+            mConnectedCallback();
+        }
+    }
+
+    inline void failed(const QString &errorMessage) {
+        if (mErrorCallback) {
+            mErrorCallback(errorMessage);
+        }
+    }
+
+    inline void log(LogType logType, const QString &message) {
+        if (mLogCallback) {
+            mLogCallback(logType, message);
+        }
+    }
+
+private:
+
+    ReadCallback mReadCallback;
+    WrittenCallback mWrittenCallback;
+    ConnectedCallback mConnectedCallback;
+    ErrorCallback mErrorCallback;
+    LogCallback mLogCallback;
+
+    bool mVerifyPeer;
+    bool mTlsOffload;
+};
+
+#endif // TRANSPORT_H
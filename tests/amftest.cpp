@@ -0,0 +1,176 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Nathan Osman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <gtest/gtest.h>
+
+#include <QtEndian>
+
+#include "amf.h"
+
+namespace
+{
+
+void appendNumber(QByteArray &data, quint32 value)
+{
+    value = qToBigEndian<quint32>(value);
+    data.append(reinterpret_cast<const char*>(&value), sizeof (value));
+}
+
+void appendKey(QByteArray &data, const QByteArray &key)
+{
+    data.append(static_cast<char>(key.size() >> 8));
+    data.append(static_cast<char>(key.size()));
+    data.append(key);
+}
+
+}
+
+TEST(Amf, RoundTripsCommandValues)
+{
+    const QVariantList values{
+        "connect",
+        1,
+        QVariant(),
+        QVariantMap{
+            {"app", "live"},
+            {"level", 2.5},
+            {"secure", true}
+        }
+    };
+
+    QVariantList decoded;
+    ASSERT_TRUE(Amf::decode(Amf::encode(values), decoded));
+    ASSERT_EQ(decoded.size(), 4);
+    EXPECT_EQ(decoded.at(0).toString(), QString("connect"));
+    EXPECT_EQ(decoded.at(1).toDouble(), 1.0);
+    EXPECT_FALSE(decoded.at(2).isValid());
+
+    const QVariantMap map = decoded.at(3).toMap();
+    EXPECT_EQ(map.value("app").toString(), QString("live"));
+    EXPECT_EQ(map.value("level").toDouble(), 2.5);
+    EXPECT_TRUE(map.value("secure").toBool());
+}
+
+TEST(Amf, DecodesEcmaAndStrictArrays)
+{
+    QByteArray data;
+    data.append('\x08');
+    appendNumber(data, 1);
+    appendKey(data, "code");
+    data.append(Amf::encode({"NetStream.Publish.Start"}));
+    appendKey(data, "");
+    data.append('\x09');
+
+    data.append('\x0a');
+    appendNumber(data, 2);
+    data.append(Amf::encode({1, "two"}));
+
+    QVariantList decoded;
+    ASSERT_TRUE(Amf::decode(data, decoded));
+    ASSERT_EQ(decoded.size(), 2);
+    EXPECT_EQ(decoded.at(0).toMap().value("code").toString(), QString("NetStream.Publish.Start"));
+
+    const QVariantList list = decoded.at(1).toList();
+    ASSERT_EQ(list.size(), 2);
+    EXPECT_EQ(list.at(0).toDouble(), 1.0);
+    EXPECT_EQ(list.at(1).toString(), QString("two"));
+}
+
+TEST(Amf, DecodesDatesLongStringsAndTypedObjects)
+{
+    // Dates are a number followed by a reserved time zone
+    QByteArray data = Amf::encode({1000.0});
+    data[0] = '\x0b';
+    data.append(2, '\0');
+
+    data.append('\x0c');
+    appendNumber(data, 3);
+    data.append("abc");
+
+    data.append('\x10');
+    appendKey(data, "Status");
+    appendKey(data, "level");
+    data.append(Amf::encode({"status"}));
+    appendKey(data, "");
+    data.append('\x09');
+
+    QVariantList decoded;
+    ASSERT_TRUE(Amf::decode(data, decoded));
+    ASSERT_EQ(decoded.size(), 3);
+    EXPECT_EQ(decoded.at(0).toDouble(), 1000.0);
+    EXPECT_EQ(decoded.at(1).toString(), QString("abc"));
+    EXPECT_EQ(decoded.at(2).toMap().value("level").toString(), QString("status"));
+}
+
+TEST(Amf, StopsAfterCount)
+{
+    // The trailing AMF3 marker is never reached
+    const QByteArray data = Amf::encode({"onStatus", 0}) + QByteArray("\x11", 1);
+
+    QVariantList decoded;
+    ASSERT_TRUE(Amf::decode(data, decoded, 2));
+    ASSERT_EQ(decoded.size(), 2);
+    EXPECT_EQ(decoded.at(0).toString(), QString("onStatus"));
+}
+
+TEST(Amf, RejectsTruncatedValues)
+{
+    const QByteArray data = Amf::encode({QVariantMap{{"description", "rejected"}}});
+
+    // Every cut falls inside the single object, so none of them may decode
+    for (int size = 1; size < data.size(); ++size) {
+        QVariantList decoded;
+        EXPECT_FALSE(Amf::decode(data.left(size), decoded)) << "size " << size;
+    }
+}
+
+TEST(Amf, RejectsOversizedStrictArray)
+{
+    QByteArray data;
+    data.append('\x0a');
+    appendNumber(data, 0xffffffff);
+    data.append(Amf::encode({1}));
+
+    QVariantList decoded;
+    EXPECT_FALSE(Amf::decode(data, decoded));
+}
+
+TEST(Amf, RejectsDeepNesting)
+{
+    QByteArray data;
+    for (int i = 0; i < 32; ++i) {
+        data.append('\x03');
+        appendKey(data, "a");
+    }
+    data.append('\x05');
+
+    QVariantList decoded;
+    EXPECT_FALSE(Amf::decode(data, decoded));
+}
+
+TEST(Amf, RejectsUnknownMarker)
+{
+    QVariantList decoded;
+    EXPECT_FALSE(Amf::decode(QByteArray("\x11", 1), decoded));
+}
@@ -0,0 +1,168 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Nathan Osman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <gtest/gtest.h>
+
+#include <QtEndian>
+
+#include "chunkscheduler.h"
+
+namespace
+{
+
+const quint8 MessageSetChunkSize = 1;
+const quint8 MessageAudio = 8;
+
+QByteArray payload(int size, char fill)
+{
+    return QByteArray(size, fill);
+}
+
+QByteArray chunkSizePayload(quint32 chunkSize)
+{
+    chunkSize = qToBigEndian<quint32>(chunkSize);
+    return QByteArray(reinterpret_cast<const char*>(&chunkSize), sizeof (chunkSize));
+}
+
+QByteArray next(ChunkScheduler &scheduler)
+{
+    QByteArray data;
+    EXPECT_TRUE(scheduler.nextChunk(data));
+    return data;
+}
+
+quint32 uint24(const QByteArray &data, int offset)
+{
+    const uchar *bytes = reinterpret_cast<const uchar*>(data.constData()) + offset;
+    return (bytes[0] << 16) | (bytes[1] << 8) | bytes[2];
+}
+
+}
+
+TEST(ChunkScheduler, SplitsMessagesAtChunkSize)
+{
+    ChunkScheduler scheduler;
+    scheduler.enqueue(4, MessageAudio, 1000, 1, payload(300, 'a'));
+
+    // A type 0 header followed by two type 3 continuations
+    const QByteArray first = next(scheduler);
+    ASSERT_EQ(first.size(), 12 + 128);
+    EXPECT_EQ(static_cast<quint8>(first.at(0)), 0x04);
+    EXPECT_EQ(uint24(first, 1), 1000u);
+    EXPECT_EQ(uint24(first, 4), 300u);
+    EXPECT_EQ(first.at(7), MessageAudio);
+    EXPECT_EQ(first.at(8), 1);
+
+    const QByteArray second = next(scheduler);
+    ASSERT_EQ(second.size(), 1 + 128);
+    EXPECT_EQ(static_cast<quint8>(second.at(0)), 0xc4);
+
+    const QByteArray third = next(scheduler);
+    ASSERT_EQ(third.size(), 1 + 44);
+    EXPECT_EQ(static_cast<quint8>(third.at(0)), 0xc4);
+
+    QByteArray data;
+    EXPECT_FALSE(scheduler.nextChunk(data));
+    EXPECT_TRUE(scheduler.isEmpty());
+}
+
+TEST(ChunkScheduler, WritesExtendedTimestamps)
+{
+    ChunkScheduler scheduler;
+    scheduler.enqueue(4, MessageAudio, 0x01000000, 1, payload(200, 'a'));
+
+    const QByteArray first = next(scheduler);
+    EXPECT_EQ(uint24(first, 1), 0xffffffu);
+    EXPECT_EQ(qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(first.constData()) + 12), 0x01000000u);
+
+    // Continuations repeat the extended timestamp
+    const QByteArray second = next(scheduler);
+    ASSERT_EQ(second.size(), 1 + 4 + 72);
+    EXPECT_EQ(qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(second.constData()) + 1), 0x01000000u);
+}
+
+TEST(ChunkScheduler, SendsControlMessagesFirst)
+{
+    ChunkScheduler scheduler;
+    scheduler.enqueue(4, MessageAudio, 0, 1, payload(300, 'a'));
+    next(scheduler);
+
+    // The control message cuts in between chunks of the audio message
+    scheduler.enqueue(ChunkScheduler::ControlChunkStreamId, 5, 0, 0, payload(4, 'c'));
+    EXPECT_EQ(static_cast<quint8>(next(scheduler).at(0)), 0x02);
+    EXPECT_EQ(static_cast<quint8>(next(scheduler).at(0)), 0xc4);
+}
+
+TEST(ChunkScheduler, AlternatesBetweenChunkStreams)
+{
+    ChunkScheduler scheduler;
+    scheduler.enqueue(3, 20, 0, 0, payload(200, 'c'));
+    scheduler.enqueue(4, MessageAudio, 0, 1, payload(200, 'a'));
+
+    EXPECT_EQ(static_cast<quint8>(next(scheduler).at(0)), 0x03);
+    EXPECT_EQ(static_cast<quint8>(next(scheduler).at(0)), 0x04);
+    EXPECT_EQ(static_cast<quint8>(next(scheduler).at(0)), 0xc3);
+    EXPECT_EQ(static_cast<quint8>(next(scheduler).at(0)), 0xc4);
+    EXPECT_TRUE(scheduler.isEmpty());
+}
+
+TEST(ChunkScheduler, DiscardPendingDropsUnsentMessages)
+{
+    ChunkScheduler scheduler;
+    scheduler.enqueue(4, MessageAudio, 0, 1, payload(100, 'a'));
+    scheduler.enqueue(4, MessageAudio, 20, 1, payload(100, 'b'));
+
+    scheduler.discardPending(4);
+    EXPECT_TRUE(scheduler.isEmpty());
+}
+
+TEST(ChunkScheduler, DiscardPendingFinishesPartialMessage)
+{
+    ChunkScheduler scheduler;
+    scheduler.enqueue(4, MessageAudio, 0, 1, payload(200, 'a'));
+    scheduler.enqueue(4, MessageAudio, 20, 1, payload(100, 'b'));
+    next(scheduler);
+
+    // The rest of the started message is still sent, the next one is not
+    scheduler.discardPending(4);
+    const QByteArray rest = next(scheduler);
+    EXPECT_EQ(rest, QByteArray(1, '\xc4') + payload(72, 'a'));
+    EXPECT_TRUE(scheduler.isEmpty());
+}
+
+TEST(ChunkScheduler, AppliesChunkSizeOnceAnnounced)
+{
+    ChunkScheduler scheduler;
+    scheduler.enqueue(ChunkScheduler::ControlChunkStreamId, MessageSetChunkSize, 0, 0, chunkSizePayload(4096));
+    scheduler.enqueue(4, MessageAudio, 0, 1, payload(1000, 'a'));
+
+    EXPECT_EQ(next(scheduler).size(), 12 + 4);
+    EXPECT_EQ(next(scheduler).size(), 12 + 1000);
+    EXPECT_TRUE(scheduler.isEmpty());
+
+    // A new connection starts over at the default size
+    scheduler.clear();
+    scheduler.enqueue(4, MessageAudio, 0, 1, payload(1000, 'a'));
+    EXPECT_EQ(next(scheduler).size(), 12 + 128);
+}
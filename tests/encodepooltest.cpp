@@ -0,0 +1,235 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Nathan Osman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <cmath>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <QtEndian>
+
+#include "encodepool.h"
+
+namespace
+{
+
+const int SamplesPerFrame = 882;
+
+const int StepSizes[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41,
+    45, 50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190,
+    209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724,
+    796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272,
+    2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132,
+    7845, 8630, 9493, 10442, 11487, 12635, 13899, 15289, 16818, 18500,
+    20350, 22385, 24623, 27086, 29794, 32767
+};
+
+const int IndexChanges[8] = {-1, -1, -1, -1, 2, 4, 6, 8};
+
+/**
+ * @brief Reads values packed most significant bit first
+ */
+class BitReader
+{
+public:
+
+    explicit BitReader(const QByteArray &data) : mData(data), mOffset(0) {}
+
+    int bitsLeft() const { return mData.size() * 8 - mOffset; }
+
+    int read(int count)
+    {
+        int value = 0;
+        for (int i = 0; i < count; ++i, ++mOffset) {
+            const int bit = (static_cast<uchar>(mData.at(mOffset / 8)) >> (7 - mOffset % 8)) & 1;
+            value = (value << 1) | bit;
+        }
+        return value;
+    }
+
+private:
+
+    const QByteArray &mData;
+    int mOffset;
+};
+
+/**
+ * @brief Decode an SWF ADPCM tag the way Flash Player and FFmpeg do
+ */
+std::vector<int> decodeAdpcm(const QByteArray &data)
+{
+    EXPECT_EQ(data.at(0), 0x1e);
+    const QByteArray payload = data.mid(1);
+    BitReader reader(payload);
+
+    std::vector<int> samples;
+    const int codeSize = reader.read(2) + 2;
+    EXPECT_EQ(codeSize, 4);
+
+    while (reader.bitsLeft() >= 22) {
+        int sample = static_cast<qint16>(reader.read(16));
+        int stepIndex = reader.read(6);
+        samples.push_back(sample);
+
+        for (int i = 1; i < 4096 && reader.bitsLeft() >= 4; ++i) {
+            const int code = reader.read(4);
+            int step = StepSizes[stepIndex];
+            int difference = 0;
+            for (int bit = 4; bit; bit >>= 1, step >>= 1) {
+                if (code & bit) {
+                    difference += step;
+                }
+            }
+            difference += step;
+            sample = qBound(-32768, sample + (code & 8 ? -difference : difference), 32767);
+            stepIndex = qBound(0, stepIndex + IndexChanges[code & 7], 88);
+            samples.push_back(sample);
+        }
+    }
+    return samples;
+}
+
+QByteArray sine(int sampleCount, int offset)
+{
+    QByteArray frame(sampleCount * 2, Qt::Uninitialized);
+    for (int i = 0; i < sampleCount; ++i) {
+        const qint16 sample = static_cast<qint16>(
+                    10000 * std::sin(2 * M_PI * 440 * (offset + i) / 44100.0));
+        qToLittleEndian<qint16>(sample, reinterpret_cast<uchar*>(frame.data()) + i * 2);
+    }
+    return frame;
+}
+
+int sampleAt(const QByteArray &frame, int index)
+{
+    return qFromLittleEndian<qint16>(reinterpret_cast<const uchar*>(frame.constData()) + index * 2);
+}
+
+}
+
+TEST(EncodePool, EncodesPcmDuringSubmit)
+{
+    EncodePool pool;
+    const int streamId = pool.addStream();
+
+    QList<quint32> timestamps;
+    QByteArray output;
+    QObject::connect(&pool, &EncodePool::encoded, [&](int, const QByteArray &data, quint32 timestamp, quint64) {
+        timestamps.append(timestamp);
+        output = data;
+    });
+
+    const QByteArray frame = sine(SamplesPerFrame, 0);
+    for (int i = 0; i < 3; ++i) {
+        pool.submit(streamId, frame);
+        EXPECT_EQ(timestamps.size(), i + 1);
+    }
+
+    EXPECT_EQ(output, QByteArray(1, '\x3e') + frame);
+    EXPECT_EQ(timestamps, (QList<quint32>{0, 20, 40}));
+}
+
+TEST(EncodePool, AdpcmDecodesCloseToInput)
+{
+    const int frameCount = 10;
+    const QByteArray input = sine(SamplesPerFrame * frameCount, 0);
+
+    EncodePool::AdpcmState state;
+    std::vector<int> samples;
+    for (int i = 0; i < frameCount; ++i) {
+        const QByteArray frame = input.mid(i * SamplesPerFrame * 2, SamplesPerFrame * 2);
+        const QByteArray data = EncodePool::encodeAdpcm(frame, state);
+
+        // Decoders find the sample count from the size, so an even count
+        // holds back its last sample rather than leave a padding nibble
+        const std::vector<int> decoded = decodeAdpcm(data);
+        EXPECT_EQ(decoded.size() % 2, 1u);
+        samples.insert(samples.end(), decoded.begin(), decoded.end());
+    }
+    ASSERT_EQ(samples.size() + state.remainder.size() / 2, static_cast<size_t>(SamplesPerFrame * frameCount));
+
+    double signal = 0;
+    double noise = 0;
+    for (size_t i = 0; i < samples.size(); ++i) {
+        const double difference = samples.at(i) - sampleAt(input, static_cast<int>(i));
+        signal += static_cast<double>(sampleAt(input, static_cast<int>(i))) * sampleAt(input, static_cast<int>(i));
+        noise += difference * difference;
+    }
+
+    EXPECT_GT(10 * std::log10(signal / noise), 25.0);
+}
+
+TEST(EncodePool, AdpcmSplitsLongFramesIntoBlocks)
+{
+    const int sampleCount = 5000;
+    const QByteArray frame = sine(sampleCount, 0);
+
+    EncodePool::AdpcmState state;
+    const std::vector<int> samples = decodeAdpcm(EncodePool::encodeAdpcm(frame, state));
+    ASSERT_EQ(samples.size(), static_cast<size_t>(sampleCount));
+
+    // The second block starts with a raw sample
+    EXPECT_EQ(samples.at(4096), sampleAt(frame, 4096));
+}
+
+TEST(EncodePool, KeepsEachAdpcmStreamInOrder)
+{
+    const int streamCount = 16;
+    const int frameCount = 50;
+
+    QMutex mutex;
+    QHash<int, QList<quint32>> timestamps;
+    {
+        EncodePool pool;
+        QObject::connect(&pool, &EncodePool::encoded, [&](int streamId, const QByteArray &, quint32 timestamp, quint64) {
+            QMutexLocker locker(&mutex);
+            timestamps[streamId].append(timestamp);
+        });
+
+        QList<int> streamIds;
+        for (int i = 0; i < streamCount; ++i) {
+            streamIds.append(pool.addStream(EncodePool::Codec::Adpcm));
+        }
+
+        const QByteArray frame = sine(SamplesPerFrame, 0);
+        for (int i = 0; i < frameCount; ++i) {
+            for (int streamId : streamIds) {
+                pool.submit(streamId, frame);
+            }
+        }
+
+        // The pool finishes every queued frame before it is destroyed
+    }
+
+    ASSERT_EQ(timestamps.size(), streamCount);
+    for (const QList<quint32> &streamTimestamps : timestamps) {
+        ASSERT_EQ(streamTimestamps.size(), frameCount);
+        for (int i = 0; i < frameCount; ++i) {
+            EXPECT_EQ(streamTimestamps.at(i), static_cast<quint32>(i * 20));
+        }
+    }
+}
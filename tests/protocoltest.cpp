@@ -0,0 +1,274 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Nathan Osman
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <gtest/gtest.h>
+
+#include <QtEndian>
+
+#include "amf.h"
+#include "protocol.h"
+
+namespace
+{
+
+const int HandshakeSize = 1536;
+
+/**
+ * @brief Transport that records writes and replays server data on demand
+ */
+class FakeTransport : public Transport
+{
+public:
+
+    void connectToHost(const QString &, quint16, bool) {}
+    void disconnectFromHost() {}
+
+    void write(const QByteArray &data) { mWritten.append(data); }
+    void flush() {}
+
+    qint64 bytesToWrite() const { return 0; }
+
+    void feed(const QByteArray &data) { received(data.constData(), data.size()); }
+
+    QByteArray takeWritten()
+    {
+        QByteArray data;
+        data.swap(mWritten);
+        return data;
+    }
+
+private:
+
+    QByteArray mWritten;
+};
+
+/**
+ * @brief Split a message into chunks in the same way a server would
+ */
+QByteArray chunks(quint8 chunkStreamId, quint8 typeId, const QByteArray &payload, int chunkSize)
+{
+    QByteArray data;
+    data.append(static_cast<char>(chunkStreamId));
+    data.append(3, '\0');
+    data.append(static_cast<char>(payload.size() >> 16));
+    data.append(static_cast<char>(payload.size() >> 8));
+    data.append(static_cast<char>(payload.size()));
+    data.append(static_cast<char>(typeId));
+    data.append(4, '\0');
+
+    for (int offset = 0; offset < payload.size(); offset += chunkSize) {
+        if (offset) {
+            data.append(static_cast<char>(0xc0 | chunkStreamId));
+        }
+        data.append(payload.mid(offset, chunkSize));
+    }
+    return data;
+}
+
+QByteArray uint32Payload(quint32 value)
+{
+    value = qToBigEndian<quint32>(value);
+    return QByteArray(reinterpret_cast<const char*>(&value), sizeof (value));
+}
+
+QByteArray serverHandshake()
+{
+    return QByteArray(1, '\x03') + QByteArray(HandshakeSize * 2, 'a');
+}
+
+QByteArray pingRequest(quint32 value)
+{
+    return chunks(2, 4, QByteArray("\0\x06", 2) + uint32Payload(value), 128);
+}
+
+QByteArray pingResponse(quint32 value)
+{
+    return QByteArray("\0\x07", 2) + uint32Payload(value);
+}
+
+/**
+ * @brief Everything the server sends for a successful publish
+ */
+QByteArray serverSession()
+{
+    QByteArray data = serverHandshake();
+
+    // The first reply is split at the default chunk size, the rest at 256
+    const QString padding(300, QLatin1Char('z'));
+    data.append(chunks(3, 20, Amf::encode({"_result", 1, QVariant(), QVariantMap{{"padding", padding}}}), 128));
+    data.append(chunks(2, 1, uint32Payload(256), 128));
+    data.append(chunks(3, 20, Amf::encode({"_result", 2, QVariant(), 1}), 256));
+    data.append(pingRequest(42));
+    data.append(chunks(3, 20, Amf::encode({"onStatus", 0, QVariant(), QVariantMap{{"code", "NetStream.Publish.Start"}}}), 256));
+    return data;
+}
+
+class ProtocolTest : public ::testing::Test
+{
+protected:
+
+    ProtocolTest()
+        : protocol(&transport)
+        , handshakes(0)
+        , publishes(0)
+    {
+        QObject::connect(&protocol, &Protocol::handshakeCompleted, [this]() {
+            ++handshakes;
+            protocol.publish("app", "rtmp://localhost/app", "key");
+        });
+        QObject::connect(&protocol, &Protocol::publishStarted, [this]() {
+            ++publishes;
+        });
+        QObject::connect(&protocol, &Protocol::error, [this](const QString &errorMessage) {
+            errors.append(errorMessage);
+        });
+    }
+
+    FakeTransport transport;
+    Protocol protocol;
+
+    int handshakes;
+    int publishes;
+    QStringList errors;
+};
+
+bool contains(const QByteArray &data, const QByteArray &value)
+{
+    return data.indexOf(value) != -1;
+}
+
+}
+
+TEST_F(ProtocolTest, PublishesAcrossAnySplit)
+{
+    const QByteArray session = serverSession();
+
+    // Every split size must reassemble the same messages
+    for (int step = 1; step <= session.size(); step += (step < 64 ? 1 : 97)) {
+        handshakes = publishes = 0;
+        errors.clear();
+
+        protocol.startHandshake();
+        transport.takeWritten();
+        for (int offset = 0; offset < session.size(); offset += step) {
+            transport.feed(session.mid(offset, step));
+        }
+
+        const QByteArray written = transport.takeWritten();
+        ASSERT_TRUE(errors.isEmpty()) << "step " << step;
+        EXPECT_EQ(handshakes, 1) << "step " << step;
+        EXPECT_EQ(publishes, 1) << "step " << step;
+        EXPECT_TRUE(contains(written, "createStream")) << "step " << step;
+        EXPECT_TRUE(contains(written, "publish")) << "step " << step;
+        EXPECT_TRUE(contains(written, pingResponse(42))) << "step " << step;
+    }
+}
+
+TEST_F(ProtocolTest, AnnouncesChunkSizeFirst)
+{
+    protocol.startHandshake();
+    EXPECT_EQ(transport.takeWritten().size(), 1 + HandshakeSize);
+
+    transport.feed(serverHandshake());
+    ASSERT_EQ(handshakes, 1);
+
+    // C2, then Set Chunk Size ahead of the connect command
+    const QByteArray written = transport.takeWritten();
+    ASSERT_GT(written.size(), HandshakeSize + 16);
+    const QByteArray setChunkSize = written.mid(HandshakeSize, 16);
+    EXPECT_EQ(setChunkSize.at(0), 2);
+    EXPECT_EQ(setChunkSize.at(7), 1);
+    EXPECT_EQ(setChunkSize.mid(12), uint32Payload(4096));
+
+    // The connect command now fits in one chunk
+    const QByteArray connect = written.mid(HandshakeSize + 16);
+    EXPECT_EQ(connect.at(0), 3);
+    EXPECT_FALSE(contains(connect, QByteArray(1, '\xc3')));
+}
+
+TEST_F(ProtocolTest, AnswersPingBetweenChunks)
+{
+    protocol.startHandshake();
+    transport.feed(serverHandshake());
+    transport.takeWritten();
+
+    // The ping arrives in the middle of a command split across chunks
+    const QByteArray command = chunks(3, 20, Amf::encode({"_result", 1, QVariant(), QString(200, QLatin1Char('x'))}), 128);
+    transport.feed(command.left(12 + 128));
+    transport.feed(pingRequest(7));
+    EXPECT_EQ(transport.takeWritten().right(6), pingResponse(7));
+
+    transport.feed(command.mid(12 + 128));
+    EXPECT_TRUE(contains(transport.takeWritten(), "createStream"));
+    EXPECT_TRUE(errors.isEmpty());
+}
+
+TEST_F(ProtocolTest, IgnoresUndecodableValues)
+{
+    protocol.startHandshake();
+    transport.feed(serverHandshake());
+    transport.takeWritten();
+
+    // An AMF3 value that cannot be decoded follows the ones that are used
+    const QByteArray amf3("\x11\x01", 2);
+    transport.feed(chunks(3, 20, Amf::encode({"_result", 1, QVariant()}) + amf3, 128));
+    EXPECT_TRUE(contains(transport.takeWritten(), "createStream"));
+
+    // Commands that were not asked for are ignored, decodable or not
+    transport.feed(chunks(3, 20, Amf::encode({"onBWDone", 0}) + amf3, 128));
+    transport.feed(chunks(3, 20, Amf::encode({"_error", 5, QVariant()}) + amf3, 128));
+    transport.feed(chunks(3, 20, amf3, 128));
+
+    transport.feed(chunks(3, 20, Amf::encode({"_result", 2, QVariant(), 1}) + amf3, 128));
+    EXPECT_TRUE(contains(transport.takeWritten(), "publish"));
+
+    transport.feed(chunks(3, 20, Amf::encode({"onStatus", 0, QVariant(), QVariantMap{{"code", "NetStream.Publish.Start"}}}) + amf3, 128));
+    EXPECT_EQ(publishes, 1);
+    EXPECT_TRUE(errors.isEmpty());
+}
+
+TEST_F(ProtocolTest, RejectsOldVersion)
+{
+    protocol.startHandshake();
+    transport.feed(QByteArray(1, '\x02') + QByteArray(HandshakeSize, 'a'));
+
+    ASSERT_EQ(errors.size(), 1);
+    EXPECT_EQ(handshakes, 0);
+}
+
+TEST_F(ProtocolTest, IgnoresInputAfterFailure)
+{
+    protocol.startHandshake();
+    transport.feed(serverHandshake());
+    transport.takeWritten();
+
+    transport.feed(chunks(2, 1, uint32Payload(0), 128));
+    ASSERT_EQ(errors.size(), 1);
+
+    // Nothing else is parsed or answered until the next handshake
+    transport.feed(pingRequest(9));
+    transport.feed(chunks(3, 20, Amf::encode({"_error", 1, QVariant(), QVariantMap()}), 128));
+    EXPECT_TRUE(transport.takeWritten().isEmpty());
+    EXPECT_EQ(errors.size(), 1);
+}